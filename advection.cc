@@ -0,0 +1,20 @@
+#include "advection.h"
+
+const char* AdvectionName(Advection advection) {
+    switch (advection) {
+        case kSemiLagrangian: return "semi-lagrangian";
+        case kMacCormack: return "maccormack";
+        default: return "central";
+    }
+}
+
+bool ParseAdvection(const std::string& name, Advection* advection) {
+    const Advection all[] = { kCentralAdvection, kSemiLagrangian, kMacCormack };
+    for (size_t a = 0; a < sizeof(all) / sizeof(all[0]); a++) {
+        if (name == AdvectionName(all[a])) {
+            *advection = all[a];
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,26 @@
+#ifndef ADVECTION_H
+#define ADVECTION_H
+
+// How the solver carries velocity and height along with the flow. The
+// original update differentiates the advection terms with central
+// differences and steps them explicitly, which gains energy at any dt. The
+// semi-Lagrangian engines instead trace each cell back along the velocity
+// for one step and interpolate the previous planes where it started, which
+// is stable however far the trace goes. Only the gravity waves then limit
+// the time step. The tracing is in the semi-Lagrangian kernels (see
+// swe_kernels.h).
+
+#include <string>
+
+enum Advection {
+    kCentralAdvection,  // central differences, stepped explicitly
+    kSemiLagrangian,    // back-traced, bilinear interpolation
+    kMacCormack,        // semi-Lagrangian plus a MacCormack correction
+};
+
+// "central", "semi-lagrangian" or "maccormack".
+const char* AdvectionName(Advection advection);
+// Returns false if name is not one of the names above.
+bool ParseAdvection(const std::string& name, Advection* advection);
+
+#endif
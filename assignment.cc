@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -5,6 +6,10 @@
 #include <cmath>
 #include <ctime>
 #include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_access.hpp>
@@ -17,6 +22,10 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include "headless.h"
+#include "shallow_water.h"
+#include "simulation_thread.h"
+
 std::ostream& operator<<(std::ostream& os, const glm::vec2& v) {
   os << glm::to_string(v);
   return os;
@@ -66,6 +75,8 @@ float roll_speed = 0.1f;
 float rotation_speed = 0.05f;
 float zoom_speed = 0.1f;
 bool fps_mode = true;
+// The refinement ratio keys 1 to 4 asked for, -1 once it is passed on.
+int refine_request = -1;
 
 glm::vec3 eye = glm::vec3(0, 1.0, camera_distance);
 glm::vec3 look = glm::vec3(0, 0, -1);
@@ -515,13 +526,13 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action,
     fps_mode = !fps_mode;
   else if (key == GLFW_KEY_0 && action != GLFW_RELEASE) {
   } else if (key == GLFW_KEY_1 && action != GLFW_RELEASE) {
-    // Fix me.
+    refine_request = 1;
   } else if (key == GLFW_KEY_2 && action != GLFW_RELEASE) {
-    // Fix me.
+    refine_request = 2;
   } else if (key == GLFW_KEY_3 && action != GLFW_RELEASE) {
-    // Fix me.
+    refine_request = 3;
   } else if (key == GLFW_KEY_4 && action != GLFW_RELEASE) {
-    // Fix me.
+    refine_request = 4;
   }
 }
 
@@ -578,16 +589,61 @@ void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
   current_button = button;
 }
 
-int main(int argc, char* argv[]) {
-    if (!glfwInit()) exit(EXIT_FAILURE);
+// The vertices of a water mesh of dimension cells a side over the pool,
+// and its triangles.
+void BuildWaterMesh(int dimension, const SolverParams& params,
+                    std::vector<float>* vertices, std::vector<uint32_t>* faces) {
+    int dimension_plus = dimension + 1;
+    vertices->resize(dimension_plus * dimension_plus * 4);
+    faces->resize(dimension * dimension * 6);
+    float dwater = params.water_len / dimension;
+    int index_i = 0, vert_i = 0;
+    for (int j = 0; j < dimension_plus; j++) {
+        for (int i = 0; i < dimension_plus; i++) {
+            (*vertices)[vert_i]     = params.water_corner + dwater * i;
+            (*vertices)[vert_i + 1] = params.water_height;
+            (*vertices)[vert_i + 2] = params.water_corner + dwater * j;
+            (*vertices)[vert_i + 3] = 1.0f;
+            vert_i += 4;
+            if (i < dimension && j < dimension) {
+                (*faces)[index_i]     = i * dimension_plus + j + 1;
+                (*faces)[index_i + 1] = i * dimension_plus + j;
+                (*faces)[index_i + 2] = (i + 1) * dimension_plus + j;
+                (*faces)[index_i + 3] = (i + 1) * dimension_plus + j;
+                (*faces)[index_i + 4] = (i + 1) * dimension_plus + j + 1;
+                (*faces)[index_i + 5] = i * dimension_plus + j + 1;
+                index_i += 6;
+            }
+        }
+    }
+}
 
-    if (argc != 3){
+int main(int argc, char* argv[]) {
+    RunOptions options;
+    if (!ParseRunOptions(argc, argv, &options)) {
         std::cout<<"Invalid args.\n";
-        std::cout<<"Usage: ./runit.sh dimension maxraindrops"<<std::endl;
+        std::cout<<"Usage: ./runit.sh [--headless] [--max-substeps N] "<<kRunOptionsUsage<<std::endl;
         exit(EXIT_SUCCESS);
     }
-    int dimension = atoi(argv[1]);
-    int maxdrops  = atoi(argv[2]);
+    if (options.headless) {
+        RunHeadless(options);
+        exit(EXIT_SUCCESS);
+    }
+    // The renderer uploads float heights every frame, so the window always
+    // runs the float solver.
+    if (options.precision != FloatPrecision::Name()) {
+        std::cerr << "Only --headless runs support --precision=" << options.precision << "\n";
+        exit(EXIT_FAILURE);
+    }
+    if (options.ranks > 1 || options.mpi) {
+        std::cerr << "Only --headless runs support --ranks and --mpi\n";
+        exit(EXIT_FAILURE);
+    }
+    int maxdrops = options.maxdrops;
+    ShallowWaterSolver solver(options.dimension, maxdrops, options.solver_params);
+    UseKernels(solver, options.kernel);
+
+    if (!glfwInit()) exit(EXIT_FAILURE);
   
     glfwSetErrorCallback(ErrorCallback);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -674,72 +730,21 @@ int main(int argc, char* argv[]) {
                                 // box bottom faces
                                 22, 20, 21,
                                 21, 23, 22};
-    // Water construction
-    float water_height = -0.3f;
-    int dimension_plus = dimension + 1;
-    int dimension_2 = dimension * dimension;
-    int dimension_plus_2 = dimension_plus * dimension_plus;
-    uint32_t * uint_arr       = new uint32_t [dimension_2 * 8 + maxdrops],
-             * water_faces    = uint_arr;
-
-    float * float_arr         = new float [dimension_plus_2 * 11 + 5 * maxdrops],
-          * water_vertices    = float_arr,                          // size: dimension_plus_2 * 4
-          * water_height_curr = float_arr + dimension_plus_2 * 4,   // size: dimension_plus_2
-          * water_height_prev = float_arr + dimension_plus_2 * 5,   // size: dimension_plus_2
-          * water_forces      = float_arr + dimension_plus_2 * 6,   // size: dimension_plus_2
-          * water_vel_prev    = float_arr + dimension_plus_2 * 7,   // size: dimension_plus_2 * 2
-          * water_vel_curr    = float_arr + dimension_plus_2 * 9;   // size: dimension_plus_2 * 2
-    float water_corner = -1.8f, water_len = 3.6f, dwater = water_len / dimension;
-    int grid_i = 0, index_i = 0, vert_i = 0, vel_i = 0;
-    for (int j = 0; j < dimension_plus; j++) {
-        for (int i = 0; i < dimension_plus; i++) {
-            // water vertices
-            water_vertices[vert_i]     = water_corner + dwater * i;
-            water_vertices[vert_i + 1] = water_height;
-            water_vertices[vert_i + 2] = water_corner + dwater * j;
-            water_vertices[vert_i + 3] = 1.0f;
-
-            water_forces[grid_i] = 0.0f;
-
-            water_vel_curr[vel_i] = 0.f;
-            water_vel_prev[vel_i] = 0.f;
-            water_vel_curr[vel_i + 1] = 0.f;
-            water_vel_prev[vel_i + 1] = 0.f;
-
-            water_height_curr[grid_i] = 0.0f;
-            water_height_prev[grid_i] = 0.0f;
-
-            vert_i += 4;
-            vel_i += 2;
-            grid_i++;
-            // water faces
-            if (i < dimension && j < dimension) {
-                water_faces[index_i]     = i * dimension_plus + j + 1;
-                water_faces[index_i + 1] = i * dimension_plus + j;
-                water_faces[index_i + 2] = (i + 1) * dimension_plus + j;
-                water_faces[index_i + 3] = (i + 1) * dimension_plus + j;
-                water_faces[index_i + 4] = (i + 1) * dimension_plus + j + 1;
-                water_faces[index_i + 5] = i * dimension_plus + j + 1;
-                index_i += 6;
-            }
-        }
-    }
+    // Water construction, at the resolution of the finest grid the solver
+    // steps. The mesh is built again when that changes.
+    const SolverParams& params = solver.Params();
+    int water_dimension = solver.RefinedDimension();
+    std::vector<float> water_vertices;
+    std::vector<uint32_t> water_faces;
+    BuildWaterMesh(water_dimension, params, &water_vertices, &water_faces);
+    std::vector<float> water_heights((water_dimension + 1) * (water_dimension + 1));
+    solver.CopyRefinedHeight(&water_heights[0]);
+    // What was on screen when the newest simulation frame arrived.
+    std::vector<float> heights_prev = water_heights;
     // Rain construction
-    float * rain_drops  = float_arr + dimension_plus_2 * 11,
-          * rain_speeds = float_arr + dimension_plus_2 * 11 + 4 * maxdrops;
-
-    uint32_t * rain_indices = uint_arr + dimension_2 * 8;
-    float range = 3.0f;
-    float precision = 1000.0f;
-    int xpos = rand() % 1000;
-    int zpos = rand() % 1000;
-    int numdrops = 0, head = 0, tail = 0;
-    for (int i=0; i < maxdrops; i++){
-        rain_drops[i * 4] = 0.f;
-        rain_drops[i * 4 + 1] = 0.f;
-        rain_drops[i * 4 + 2] = 0.f;
-        rain_drops[i * 4 + 3] = 0.f;
-        rain_speeds[0] = 0.0f;
+    std::vector<uint32_t> rain_indices(maxdrops);
+    for (int i = 0; i < maxdrops; i++) {
+        rain_indices[i] = i;
     }
     // Plane construction
     const float plane_vertices [20] = {    0.f, -2.f, 0.f, 1.f,     99999.f, 0.f, 0.f, 0.f,    0.f, 0.f, 99999.f, 0.f,
@@ -765,29 +770,29 @@ int main(int argc, char* argv[]) {
     CHECK_GL_ERROR(glGenBuffers(kNumVbos, &buffer_objects[kWaterVao][0]));
     // Setup vertex data in a VBO.
     CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, buffer_objects[kWaterVao][kVertexBuffer]));
-    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * dimension_plus_2 * 4, water_vertices, GL_STATIC_DRAW));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * water_vertices.size(), &water_vertices[0], GL_STATIC_DRAW));
     CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
     CHECK_GL_ERROR(glEnableVertexAttribArray(0));
     // Setup vertex data in a VBO.
     CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, buffer_objects[kWaterVao][kVertAttr1]));
-    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * dimension_plus_2, water_height_curr, GL_STATIC_DRAW));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * water_heights.size(), &water_heights[0], GL_STATIC_DRAW));
     CHECK_GL_ERROR(glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, 0));
     CHECK_GL_ERROR(glEnableVertexAttribArray(1));
     // Setup element array buffer.
     CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer_objects[kWaterVao][kIndexBuffer]));
-    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * dimension_2 * 6, water_faces, GL_STATIC_DRAW));
+    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * water_faces.size(), &water_faces[0], GL_STATIC_DRAW));
     //setup the rain
     CHECK_GL_ERROR(glBindVertexArray(array_objects[kRainVao]));
     // Generate buffer objects
     CHECK_GL_ERROR(glGenBuffers(kNumVbos, &buffer_objects[kRainVao][0]));
     // Setup vertex data in a VBO.
     CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, buffer_objects[kRainVao][kVertexBuffer]));
-    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * maxdrops * 4, rain_drops, GL_STATIC_DRAW));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * maxdrops * 4, solver.RainDrops(), GL_STATIC_DRAW));
     CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
     CHECK_GL_ERROR(glEnableVertexAttribArray(0));
     // Setup element array buffer.
     CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer_objects[kRainVao][kIndexBuffer]));
-    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * maxdrops, rain_indices, GL_STATIC_DRAW));
+    CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * maxdrops, &rain_indices[0], GL_STATIC_DRAW));
     //setup the plane project
     CHECK_GL_ERROR(glBindVertexArray(array_objects[kPlaneVao]));
     // Generate buffer objects
@@ -849,14 +854,14 @@ int main(int argc, char* argv[]) {
     glm::vec3 plane_color = glm::vec3(0.0f, 0.6f, 0.0f);
     glm::vec3 box_color = glm::vec3(0.4f, 0.2f, 0.0f);
     glm::vec3 water_color = glm::vec3(0.0f, 0.4f, 1.0f);
-    // rain variables
-    clock_t prev = clock();
-    float gravity = 10.0f; //lol
-    float forceconst = 2.0f;
-    float H = 1.7f;
-    float time = 0;
-    float delta = 0.3f;
     // FILE * log = fopen(log);
+    // The solver belongs to the simulation thread from here on. Each frame
+    // draws the water partway from heights_prev to the newest finished
+    // state, moving at the rate simulated time passes.
+    SimulationThread simulation(solver, options.max_substeps);
+    float shown_time = simulation.Latest().time;
+    float blend_from = shown_time;
+    std::chrono::steady_clock::time_point blend_start = std::chrono::steady_clock::now();
     // Main loop
     while (!glfwWindowShouldClose(window)) {
         // Setup some basic window stuff.
@@ -875,153 +880,39 @@ int main(int argc, char* argv[]) {
         glm::mat4 projection_matrix = glm::perspective(45.0f, aspect, 0.0001f, 1000.0f);
         glm::mat4 view_matrix = glm::lookAt(eye, eye + camera_distance * look, up);
 
-        clock_t curr = clock();
-        float diff = 0.003333f / 2.0f;
-        time += diff;
-        prev = curr;
-        for (int x = 0; x < numdrops; x++) {
-            int k = (x + head) % maxdrops;
-            if (rain_drops[k * 4 + 1] < water_height){
-                int i = (int)((rain_drops[k * 4 + 0] - water_corner) / dwater);
-                int j = (int)((rain_drops[k * 4 + 2] - water_corner) / dwater);
-                int index = j * (dimension + 1) + i;
-                numdrops--;
-                head++;
-                water_faces[k] = water_faces[numdrops];
-                water_forces[index] = forceconst;
-            } else {
-                rain_speeds[k] += gravity * diff;
-                rain_drops[k * 4 + 1] -= rain_speeds[k] * diff;
-            }
-        }
-        int rain_check = rand() % 1000;
-        if (numdrops < maxdrops && rain_check > 950){
-            float range = 3.0f;
-            float precision = 1000.0f;
-            int xpos = rand() % 1000;
-            int zpos = rand() % 1000;
-            rain_drops[tail * 4] = xpos / precision * range - 1.5f;
-            rain_drops[tail * 4 + 1] = 5.f;
-            rain_drops[tail * 4 + 2] = zpos / precision * range - 1.5f;
-            rain_drops[tail * 4 + 3] = 1.f;
-            rain_speeds[tail] = 2.f;
-            water_faces[numdrops] = tail++;
-            tail %= maxdrops;
-            numdrops++;
+        if (refine_request >= 0) {
+            simulation.SetRefine(refine_request);
+            refine_request = -1;
         }
-        vel_i = 0;
-        grid_i = 0;
-        for (int j = 0; j < dimension_plus; j++) {
-            for (int i = 0; i < dimension_plus; i++) {
-                water_vel_prev[vel_i] = water_vel_curr[vel_i];
-                water_vel_prev[vel_i + 1] = water_vel_curr[vel_i + 1];
-                vel_i += 2;
-
-                water_height_prev[grid_i] = water_height_curr[grid_i];
-                grid_i++;
+        std::chrono::steady_clock::time_point frame = std::chrono::steady_clock::now();
+        if (simulation.Update()) {
+            const SimulationFrame& latest = simulation.Latest();
+            if (latest.dimension != water_dimension) {
+                // The refinement changed: show the new frame as it is on a
+                // mesh of its size.
+                water_dimension = latest.dimension;
+                BuildWaterMesh(water_dimension, params, &water_vertices, &water_faces);
+                water_heights = latest.heights;
+                heights_prev = latest.heights;
+                CHECK_GL_ERROR(glBindVertexArray(array_objects[kWaterVao]));
+                CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, buffer_objects[kWaterVao][kVertexBuffer]));
+                CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * water_vertices.size(), &water_vertices[0], GL_STATIC_DRAW));
+                CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer_objects[kWaterVao][kIndexBuffer]));
+                CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * water_faces.size(), &water_faces[0], GL_STATIC_DRAW));
             }
+            std::swap(heights_prev, water_heights);
+            blend_from = shown_time;
+            blend_start = frame;
         }
-        float double_dwater = 2 * dwater;
-        vel_i = 0, grid_i = 0;
-        for (int j = 0; j < dimension_plus; j++){
-            for (int i = 0; i < dimension_plus; i++){
-                float height_grad_i = 0;
-                float height_grad_j = 0;
-                float force_grad_i = 0;
-                float force_grad_j = 0;
-                glm::vec2 dudx;
-                glm::vec2 dvdx;
-                glm::vec2 prev_vel       = glm::vec2(water_vel_prev[vel_i], water_vel_prev[vel_i + 1]),
-                          prev_vel_left  = glm::vec2(water_vel_prev[vel_i - 2], water_vel_prev[vel_i - 1]),
-                          prev_vel_right = glm::vec2(water_vel_prev[vel_i + 2], water_vel_prev[vel_i + 3]),
-                          prev_vel_down  = glm::vec2(water_vel_prev[vel_i + dimension_plus * 2],
-                                                     water_vel_prev[vel_i + dimension_plus * 2 + 1]),
-                          prev_vel_up    = glm::vec2(water_vel_prev[vel_i - dimension_plus * 2],
-                                                      water_vel_prev[vel_i - dimension_plus * 2 + 1]);
-
-                float height       = water_height_prev[grid_i];
-                float height_left  = water_height_prev[grid_i - 1];
-                float height_right = water_height_prev[grid_i + 1];
-                float height_down  = water_height_prev[grid_i + dimension_plus];
-                float height_up    = water_height_prev[grid_i - dimension_plus];
-
-                float force       = water_forces[grid_i];
-                float force_left  = water_forces[grid_i - 1];
-                float force_right = water_forces[grid_i + 1];
-                float force_down  = water_forces[grid_i + dimension_plus];
-                float force_up    = water_forces[grid_i - dimension_plus];
-                if (i == 0){
-                    height_grad_i = (height_right - height) / (double_dwater);
-                    force_grad_i  = (force_right - force) / (double_dwater);
-                    dudx          = (prev_vel_right - prev_vel) / (double_dwater);
-                } else if (i == dimension){
-                    height_grad_i = (height - height_left) / (double_dwater);
-                    force_grad_i  = (force - force_left) / (double_dwater);
-                    dudx = (prev_vel - prev_vel_left) / (double_dwater);
-                } else {
-                    height_grad_i = (height_right - height_left) / (double_dwater);
-                    force_grad_i  = (force_right - force_left) / (double_dwater);
-                    dudx          = (prev_vel_right - prev_vel_left) / (double_dwater);
-                }
-                if (j == 0){
-                    height_grad_j = (height_down - height) / (double_dwater);
-                    force_grad_j  = (force_down - force) / (double_dwater);
-                    dvdx = (prev_vel_down - prev_vel) / (double_dwater);
-                } else if (j == dimension){
-                    height_grad_j = (height - height_up) / (double_dwater);
-                    force_grad_j  = (force - force_up) / (double_dwater);
-                    dvdx = (prev_vel - prev_vel_up) / (double_dwater);
-                } else {
-                    height_grad_j = (height_down - height_up) / (double_dwater);
-                    force_grad_j  = (force_down - force_up) / (double_dwater);
-                    dvdx = (prev_vel_down - prev_vel_up) / (double_dwater);
-                }
-                glm::vec2 height_gradient (height_grad_i, height_grad_j);
-                glm::vec2 force_gradient (force_grad_i, force_grad_j);
-                glm::vec2 u_dudx = water_vel_prev[vel_i] * dudx;
-                glm::vec2 v_dvdx = water_vel_prev[vel_i + 1] * dvdx;
-                glm::vec2 curr_vel = (-(gravity + force) * height_gradient
-                                      - 1.7f * force_gradient - u_dudx - v_dvdx) * diff
-                                     + prev_vel;
-                water_vel_curr[vel_i] = curr_vel[0];
-                water_vel_curr[vel_i + 1] = curr_vel[1];
-                grid_i++;
-                vel_i += 2;
-            }
+        const SimulationFrame& latest = simulation.Latest();
+        float span = latest.time - blend_from;
+        float alpha = 1.0f;
+        if (span > 0.0f) {
+            alpha = std::min(1.0f, std::chrono::duration<float>(frame - blend_start).count() / span);
         }
-        grid_i = dimension_plus;
-        vel_i = dimension_plus * 2;
-        for (int j = 1; j < dimension; j++){
-            for (int i = 1; i < dimension; i++){
-                int k = dimension_plus * j + i;
-                grid_i++;
-                vel_i += 2;
-                glm::vec2 dudx;
-                glm::vec2 dvdx;
-                glm::vec2 vel       = glm::vec2(water_vel_curr[vel_i], water_vel_curr[vel_i + 1]),
-                          vel_left  = glm::vec2(water_vel_curr[vel_i - 2], water_vel_curr[vel_i - 1]),
-                          vel_right = glm::vec2(water_vel_curr[vel_i + 2], water_vel_curr[vel_i + 3]),
-                          vel_down  = glm::vec2(water_vel_curr[vel_i + dimension_plus * 2],
-                                                water_vel_curr[vel_i + dimension_plus * 2 + 1]),
-                          vel_up    = glm::vec2(water_vel_curr[vel_i - dimension_plus * 2],
-                                                water_vel_curr[vel_i - dimension_plus * 2 + 1]);
-
-                float height       = water_height_prev[grid_i];
-                float height_left  = water_height_prev[grid_i - 1];
-                float height_right = water_height_prev[grid_i + 1];
-                float height_down  = water_height_prev[grid_i + dimension_plus];
-                float height_up    = water_height_prev[grid_i - dimension_plus];
-                // TODO: water pressure or some shit 
-                water_forces[grid_i] = 0;
-                float vel_grad_x = (vel_right[0] - vel_left[0]) / (double_dwater);
-                float u_dhdx = vel[0]  * (height_right - height_left) / (double_dwater);
-                float vel_grad_y = (vel_down[1] - vel_up[1]) / (double_dwater);
-                float v_dhdy = vel[1] * (height_down  - height_up) / (double_dwater);
-                water_height_curr[grid_i] = (-(water_height_prev[grid_i] + H) * (vel_grad_x + vel_grad_y) - u_dhdx - v_dhdy)
-                                            * diff + water_height_prev[grid_i];
-            }
-            grid_i += 2;
-            vel_i  += 4;
+        shown_time = blend_from + alpha * span;
+        for (size_t k = 0; k < water_heights.size(); k++) {
+            water_heights[k] = heights_prev[k] + alpha * (latest.heights[k] - heights_prev[k]);
         }
         if (basic_program.ReadyProgram()){
             // Set uniforms
@@ -1047,11 +938,11 @@ int main(int argc, char* argv[]) {
             water_program.SetUniform("diffuse_color", water_color);
             CHECK_GL_ERROR(glBindVertexArray(array_objects[kWaterVao]));
             CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, buffer_objects[kWaterVao][kVertAttr1]));
-            CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * dimension_plus_2, water_height_curr, GL_STATIC_DRAW));
-            CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, dimension_2 * 6, GL_UNSIGNED_INT, 0));
+            CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * water_heights.size(), &water_heights[0], GL_STATIC_DRAW));
+            CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, water_faces.size(), GL_UNSIGNED_INT, 0));
         }
 
-        if (rain_program.ReadyProgram() && numdrops > 0){
+        if (rain_program.ReadyProgram() && latest.numdrops > 0){
             rain_program.SetUniform("projection", projection_matrix);
             rain_program.SetUniform("view", view_matrix);
             glm::vec4 red = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
@@ -1059,18 +950,17 @@ int main(int argc, char* argv[]) {
             CHECK_GL_ERROR(glBindVertexArray(array_objects[kRainVao]));
             // Setup vertex data in a VBO.
             CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, buffer_objects[kRainVao][kVertexBuffer]));
-            CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * maxdrops * 4, rain_drops, GL_STATIC_DRAW));
+            CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * maxdrops * 4, &latest.rain_drops[0], GL_STATIC_DRAW));
             CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer_objects[kRainVao][kIndexBuffer]));
-            CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * numdrops, rain_indices, GL_STATIC_DRAW));
-            CHECK_GL_ERROR(glDrawArrays(GL_POINTS, 0, numdrops));
+            CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * latest.numdrops, &rain_indices[0], GL_STATIC_DRAW));
+            CHECK_GL_ERROR(glDrawArrays(GL_POINTS, 0, latest.numdrops));
         }
 
         // Poll and swap.
         glfwPollEvents();
         glfwSwapBuffers(window);
     }
-    delete [] float_arr;
-    delete [] uint_arr;
+    simulation.Stop();
     glfwDestroyWindow(window);
     glfwTerminate();
     exit(EXIT_SUCCESS);
@@ -0,0 +1,60 @@
+#include "grid_layout.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+// Interleaves the bits of x and y, x in the even bits.
+uint64_t MortonCode(uint32_t x, uint32_t y) {
+    uint64_t code = 0;
+    for (int bit = 0; bit < 32; bit++) {
+        code |= (uint64_t)((x >> bit) & 1) << (2 * bit);
+        code |= (uint64_t)((y >> bit) & 1) << (2 * bit + 1);
+    }
+    return code;
+}
+
+}  // namespace
+
+const char* GridLayoutName(GridLayout layout) {
+    switch (layout) {
+        case kBlocked: return "blocked";
+        case kMorton: return "morton";
+        default: return "rows";
+    }
+}
+
+bool ParseGridLayout(const std::string& name, GridLayout* layout) {
+    const GridLayout all[] = { kRowMajor, kBlocked, kMorton };
+    for (size_t l = 0; l < sizeof(all) / sizeof(all[0]); l++) {
+        if (name == GridLayoutName(all[l])) {
+            *layout = all[l];
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<int> BlockOffsets(GridLayout layout, int blocks_x, int blocks_y,
+                              int block_floats) {
+    // Blocks are numbered row-major and stored in the order of their sort
+    // key. Column-major order keeps each column of blocks, which a band
+    // sweep walks down, contiguous. Morton order skips the codes that fall
+    // outside a grid that is not a power of two wide.
+    int blocks = blocks_x * blocks_y;
+    std::vector<std::pair<uint64_t, int> > order;
+    for (int b = 0; b < blocks; b++) {
+        uint64_t key = (uint64_t)(b % blocks_x) * blocks_y + b / blocks_x;
+        if (layout == kMorton) {
+            key = MortonCode(b % blocks_x, b / blocks_x);
+        }
+        order.push_back(std::make_pair(key, b));
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<int> offsets(blocks);
+    for (int rank = 0; rank < blocks; rank++) {
+        offsets[order[rank].second] = rank * block_floats;
+    }
+    return offsets;
+}
@@ -0,0 +1,70 @@
+#ifndef GRID_LAYOUT_H
+#define GRID_LAYOUT_H
+
+// How the cells of a plane are laid out in memory. Each layout maps cell
+// (i, j), ghost cells included, to an offset from the plane pointer, and
+// splits every row into runs of columns that are contiguous in memory. The
+// row kernels work on one run at a time; only the cells at the ends of a
+// run need neighbours from outside it.
+
+#include <string>
+#include <vector>
+
+enum GridLayout {
+    kRowMajor,  // one run per row, rows stride floats apart
+    kBlocked,   // square blocks stored row-major, blocks in column-major order
+    kMorton,    // the same blocks in Z (Morton) order
+};
+
+// Bytes each plane allocation, and the first cell of every run, is aligned
+// to.
+const int kPlaneAlignment = 64;
+
+// Elements from one row of a row-major plane to the next, for rows of cells
+// elements plus halo ghost cells on each side, padded so that the first
+// cell of every row is aligned to align elements.
+constexpr int RowStride(int cells, int halo, int align) {
+    return ((halo + align - 1) / align * align + cells + halo + align - 1) / align * align;
+}
+
+// "rows", "blocked" or "morton".
+const char* GridLayoutName(GridLayout layout);
+// Returns false if name is not one of the names above.
+bool ParseGridLayout(const std::string& name, GridLayout* layout);
+
+// Row-major rows of stride floats. A row is one run, ghost cells included.
+struct RowLayout {
+    int stride;
+
+    int Index(int i, int j) const { return j * stride + i; }
+    // The run holding column i is [RunStart(i), RunEnd(i)).
+    int RunStart(int) const { return -(1 << 29); }
+    int RunEnd(int) const { return 1 << 29; }
+};
+
+// kBlock x kBlock blocks of kBlock * kBlock floats, each stored row-major,
+// so a cell's vertical neighbours are usually in the same 4 KB block
+// rather than a whole grid row away. A block row is one run.
+struct BlockLayout {
+    static const int kBlock = 32;
+
+    int shift_x;               // column of cell (0, 0) within the blocks
+    int shift_y;               // row of cell (0, 0) within the blocks
+    int blocks_x;
+    const int* block_offset;   // offset of block (bx, by) at [by * blocks_x + bx]
+
+    int Index(int i, int j) const {
+        int x = i + shift_x, y = j + shift_y;
+        return block_offset[y / kBlock * blocks_x + x / kBlock]
+               + y % kBlock * kBlock + x % kBlock;
+    }
+    int RunStart(int i) const { return (i + shift_x) / kBlock * kBlock - shift_x; }
+    int RunEnd(int i) const { return RunStart(i) + kBlock; }
+};
+
+// Offsets for blocks_x * blocks_y blocks of block_floats floats in the
+// order the layout stores them.
+std::vector<int> BlockOffsets(GridLayout layout, int blocks_x, int blocks_y,
+                              int block_floats);
+
+#endif
@@ -0,0 +1,245 @@
+#include "halo_transport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef SWE_HAVE_MPI
+// Only the C API; the C++ bindings are deprecated.
+#define OMPI_SKIP_MPICXX
+#define MPICH_SKIP_MPICXX
+#include <mpi.h>
+#endif
+
+namespace {
+
+static_assert(ATOMIC_LONG_LOCK_FREE == 2,
+              "the shared memory transport needs address-free atomics");
+
+const size_t kLine = 64;
+
+size_t RoundUpToLine(size_t bytes) {
+    return (bytes + kLine - 1) / kLine * kLine;
+}
+
+// Each rank has a header and a mailbox per direction and parity, in one
+// segment every rank maps. A rank writes its own mailboxes and reads its
+// neighbours'. Calls alternate between two parities, so a rank fills one
+// mailbox while its neighbours may still read the other: it cannot get two
+// calls ahead, because the call in between waits for them.
+struct ShmHeader {
+    std::atomic<unsigned long> exchanged;  // Exchange() calls posted
+    std::atomic<unsigned long> reduced;    // MaxAll() calls posted
+    double values[2][HaloTransport::kMaxValues];
+};
+
+class ShmTransport : public HaloTransport {
+    private:
+        enum { kUp, kDown };
+
+        int rank;
+        int size;
+        size_t capacity;
+        size_t stride;  // bytes per rank
+        char* memory;
+        size_t bytes;
+        std::vector<pid_t> children;  // rank 0 only
+        unsigned long exchanges;
+        unsigned long reductions;
+
+        ShmHeader* Header(int r) {
+            return reinterpret_cast<ShmHeader*>(memory + r * stride);
+        }
+        char* Mailbox(int r, int parity, int direction) {
+            return memory + r * stride + RoundUpToLine(sizeof(ShmHeader))
+                   + (parity * 2 + direction) * capacity;
+        }
+        // Spins until counter reaches at least target. The ranks usually
+        // arrive within a step of each other, so they yield rather than
+        // sleep.
+        static void Wait(const std::atomic<unsigned long>& counter, unsigned long target) {
+            while (counter.load(std::memory_order_acquire) < target) {
+                std::this_thread::yield();
+            }
+        }
+
+        ShmTransport(const ShmTransport&);
+        ShmTransport& operator=(const ShmTransport&);
+    public:
+        ShmTransport(int rank, int size, size_t capacity, size_t stride,
+                     char* memory, size_t bytes, const std::vector<pid_t>& children) :
+                rank(rank),
+                size(size),
+                capacity(capacity),
+                stride(stride),
+                memory(memory),
+                bytes(bytes),
+                children(children),
+                exchanges(0),
+                reductions(0) {}
+
+        ~ShmTransport() {
+            for (size_t c = 0; c < children.size(); c++) {
+                waitpid(children[c], nullptr, 0);
+            }
+            munmap(memory, bytes);
+        }
+
+        int Rank() const { return rank; }
+        int Size() const { return size; }
+        const char* Name() const { return "shm"; }
+
+        void Exchange(const void* to_up, void* from_up,
+                      const void* to_down, void* from_down, size_t message) {
+            unsigned long call = ++exchanges;
+            int parity = call % 2;
+            if (rank > 0) {
+                std::memcpy(Mailbox(rank, parity, kUp), to_up, message);
+            }
+            if (rank + 1 < size) {
+                std::memcpy(Mailbox(rank, parity, kDown), to_down, message);
+            }
+            Header(rank)->exchanged.store(call, std::memory_order_release);
+            if (rank > 0) {
+                Wait(Header(rank - 1)->exchanged, call);
+                std::memcpy(from_up, Mailbox(rank - 1, parity, kDown), message);
+            }
+            if (rank + 1 < size) {
+                Wait(Header(rank + 1)->exchanged, call);
+                std::memcpy(from_down, Mailbox(rank + 1, parity, kUp), message);
+            }
+        }
+
+        void MaxAll(double* values, int n) {
+            unsigned long call = ++reductions;
+            int parity = call % 2;
+            std::copy(values, values + n, Header(rank)->values[parity]);
+            Header(rank)->reduced.store(call, std::memory_order_release);
+            for (int r = 0; r < size; r++) {
+                Wait(Header(r)->reduced, call);
+                for (int k = 0; k < n; k++) {
+                    values[k] = std::max(values[k], Header(r)->values[parity][k]);
+                }
+            }
+        }
+
+        void Barrier() { MaxAll(nullptr, 0); }
+};
+
+#ifdef SWE_HAVE_MPI
+class MpiTransport : public HaloTransport {
+    private:
+        int rank;
+        int size;
+
+        MpiTransport(const MpiTransport&);
+        MpiTransport& operator=(const MpiTransport&);
+    public:
+        MpiTransport() {
+            // Only the thread that steps the solver calls MPI; the workers
+            // never do.
+            int provided;
+            MPI_Init_thread(nullptr, nullptr, MPI_THREAD_FUNNELED, &provided);
+            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+            MPI_Comm_size(MPI_COMM_WORLD, &size);
+        }
+        ~MpiTransport() { MPI_Finalize(); }
+
+        int Rank() const { return rank; }
+        int Size() const { return size; }
+        const char* Name() const { return "mpi"; }
+
+        void Exchange(const void* to_up, void* from_up,
+                      const void* to_down, void* from_down, size_t message) {
+            int up = rank > 0 ? rank - 1 : MPI_PROC_NULL;
+            int down = rank + 1 < size ? rank + 1 : MPI_PROC_NULL;
+            int count = (int)message;
+            MPI_Sendrecv(const_cast<void*>(to_up), count, MPI_BYTE, up, 0,
+                         from_down, count, MPI_BYTE, down, 0,
+                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Sendrecv(const_cast<void*>(to_down), count, MPI_BYTE, down, 1,
+                         from_up, count, MPI_BYTE, up, 1,
+                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+
+        void MaxAll(double* values, int n) {
+            MPI_Allreduce(MPI_IN_PLACE, values, n, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        }
+
+        void Barrier() { MPI_Barrier(MPI_COMM_WORLD); }
+};
+#endif
+
+}  // namespace
+
+HaloTransport* NewShmTransport(int ranks, size_t capacity) {
+    capacity = RoundUpToLine(capacity);
+    size_t stride = RoundUpToLine(sizeof(ShmHeader)) + 4 * capacity;
+    size_t bytes = stride * ranks;
+    // The name only lives until every rank has the segment mapped: the
+    // children inherit the mapping.
+    std::string name = "/swe-halo-" + std::to_string(getpid());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+    void* mapped = MAP_FAILED;
+    if (ftruncate(fd, bytes) == 0) {
+        mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    shm_unlink(name.c_str());
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+    char* memory = static_cast<char*>(mapped);
+    for (int r = 0; r < ranks; r++) {
+        ShmHeader* header = new (memory + r * stride) ShmHeader;
+        header->exchanged.store(0);
+        header->reduced.store(0);
+    }
+    // Whatever is buffered would otherwise be written once per rank.
+    std::fflush(nullptr);
+    int rank = 0;
+    std::vector<pid_t> children;
+    for (int r = 1; r < ranks; r++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            // The ranks already forked would wait forever for the missing
+            // one. The name is unlinked already, so the segment goes with
+            // the last mapping.
+            for (size_t c = 0; c < children.size(); c++) {
+                kill(children[c], SIGKILL);
+                waitpid(children[c], nullptr, 0);
+            }
+            munmap(memory, bytes);
+            return nullptr;
+        }
+        if (pid == 0) {
+            rank = r;
+            children.clear();
+            break;
+        }
+        children.push_back(pid);
+    }
+    return new ShmTransport(rank, ranks, capacity, stride, memory, bytes, children);
+}
+
+HaloTransport* NewMpiTransport() {
+#ifdef SWE_HAVE_MPI
+    return new MpiTransport();
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,46 @@
+#ifndef HALO_TRANSPORT_H
+#define HALO_TRANSPORT_H
+
+// Moves halo rows between processes that each step one band of the grid's
+// rows. Ranks 0 to Size() - 1 own the bands from the top of the grid down,
+// so each rank exchanges with rank - 1 above it and rank + 1 below it.
+// Every rank calls the same methods in the same order, from one thread.
+//
+// Two transports: POSIX shared memory between processes forked on one
+// host, and MPI where the build found it.
+
+#include <cstddef>
+
+class HaloTransport {
+    public:
+        virtual ~HaloTransport() {}
+
+        virtual int Rank() const = 0;
+        virtual int Size() const = 0;
+        virtual const char* Name() const = 0;
+        // Sends bytes from to_up to rank - 1 and from to_down to rank + 1,
+        // and receives what they sent this way into from_up and from_down.
+        // The neighbours past the first and last rank are skipped.
+        virtual void Exchange(const void* to_up, void* from_up,
+                              const void* to_down, void* from_down, size_t bytes) = 0;
+        // Replaces values[0, n) on every rank with the largest of each
+        // across the ranks. n is at most kMaxValues.
+        virtual void MaxAll(double* values, int n) = 0;
+        // Returns once every rank has called it.
+        virtual void Barrier() = 0;
+
+        static const int kMaxValues = 8;
+};
+
+// Forks ranks - 1 children, which return from here as ranks 1 and up while
+// the caller becomes rank 0, and exchanges messages of up to capacity bytes
+// through POSIX shared memory. Call it before starting any threads. Returns
+// nullptr, without forking, if the shared memory cannot be set up, and
+// also if a fork fails, after killing the children forked so far. Deleting
+// rank 0's transport waits for the other ranks to exit.
+HaloTransport* NewShmTransport(int ranks, size_t capacity);
+// The ranks of MPI_COMM_WORLD, or nullptr if the build has no MPI. Deleting
+// the transport finalizes MPI.
+HaloTransport* NewMpiTransport();
+
+#endif
@@ -0,0 +1,242 @@
+#include "headless.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "halo_transport.h"
+
+const char* const kRunOptionsUsage =
+    "[--steps N] [--print-dt] [--adaptive-dt] [--cfl C] [--max-dt S] [--implicit-height]"
+    " [--multigrid-cycles N] [--threads N] [--tile N] [--sparse] [--activity-threshold A]"
+    " [--temporal-block K] [--refine R] [--refine-block B] [--refine-steepness S] [--rain N]"
+    " [--impact-radius R] [--ranks N] [--mpi] [--numa] [--layout=rows|blocked|morton]"
+    " [--advection=central|semi-lagrangian|maccormack] [--kernel=scalar|sse|avx2|avx512]"
+    " [--precision=float|double|half] [--generic] dimension maxraindrops";
+
+namespace {
+
+// Steps a solver of precision P as fast as it will go and reports the
+// throughput, and with print_dt the time step each step took.
+template <typename P>
+void RunPrecision(const RunOptions& options) {
+    const SolverParams& params = options.solver_params;
+    int dimension = options.dimension;
+    int steps = options.steps;
+    HaloTransport* transport = nullptr;
+    if (options.mpi) {
+        transport = NewMpiTransport();
+        if (transport == nullptr) {
+            std::cerr << "This build has no MPI\n";
+            exit(EXIT_FAILURE);
+        }
+    } else if (options.ranks > 1) {
+        transport = NewShmTransport(options.ranks, BasicShallowWaterSolver<P>::HaloBytes(dimension));
+        if (transport == nullptr) {
+            std::cerr << "Could not start " << options.ranks << " ranks on shared memory\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    SolverParams split = params;
+    split.transport = transport;
+    BasicShallowWaterSolver<P> solver(dimension, options.maxdrops, split);
+    UseKernels(solver, options.kernel);
+    std::vector<float> dts;
+    dts.reserve(steps);
+    double active_tiles = 0;
+    double patches = 0, refined_vertices = 0;
+    // The clock runs from when every rank is ready until the last is done.
+    if (transport != nullptr) {
+        transport->Barrier();
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; ) {
+        // Advance() takes a temporal block at a time, all at the same dt.
+        int n = std::min(solver.TemporalBlock(), steps - s);
+        dts.insert(dts.end(), n, solver.StepDt());
+        solver.Advance(n);
+        active_tiles += n * solver.ActiveTiles();
+        patches += n * solver.Patches();
+        refined_vertices += n * static_cast<double>(solver.RefinedVertices());
+        s += n;
+    }
+    if (transport != nullptr) {
+        transport->Barrier();
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    if (transport != nullptr && transport->Rank() > 0) {
+        delete transport;
+        return;
+    }
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double cells = static_cast<double>(solver.DimensionPlus()) * solver.DimensionPlus();
+    std::cout << "precision: " << P::Name() << "\n";
+    std::cout << "kernel: " << solver.KernelName() << "\n";
+    std::cout << "fixed size: " << (solver.Specialized() ? "yes" : "no") << "\n";
+    std::cout << "layout: " << GridLayoutName(solver.Layout()) << "\n";
+    std::cout << "advection: " << AdvectionName(params.advection) << "\n";
+    if (params.implicit_height) {
+        std::cout << "height update: implicit, " << solver.MultigridLevels()
+                  << " multigrid levels, " << params.multigrid_cycles << " cycles\n";
+    } else {
+        std::cout << "height update: explicit\n";
+    }
+    if (params.rain != 1 || params.impact_radius > 0) {
+        std::cout << "rain: " << params.rain << " chances a step, impact radius "
+                  << params.impact_radius << "\n";
+    }
+    if (solver.TemporalBlock() > 1) {
+        std::cout << "temporal block: " << solver.TemporalBlock() << " steps\n";
+    }
+    if (solver.RefinedDimension() > solver.Dimension() && steps > 0) {
+        double fine = static_cast<double>(solver.RefinedDimension() + 1)
+                      * (solver.RefinedDimension() + 1);
+        std::cout << "refinement: " << solver.RefineRatio()
+                  << " times in blocks of " << params.refine_block << " cells, "
+                  << patches / steps << " patches and "
+                  << 100 * refined_vertices / steps / fine
+                  << "% of the fine vertices stepped on average\n";
+    }
+    if (transport != nullptr) {
+        int j0, j1;
+        solver.OwnedRows(&j0, &j1);
+        std::cout << "ranks: " << transport->Size() << " (" << transport->Name()
+                  << "), rank 0 steps rows " << j0 << " to " << j1 - 1 << "\n";
+    }
+    std::cout << "threads: " << solver.Threads() << "\n";
+    if (solver.Tiles() > 0 && steps > 0) {
+        std::cout << "active tiles: " << 100 * active_tiles / steps / solver.Tiles()
+                  << "% of " << solver.Tiles() << " on average\n";
+    }
+    if (solver.Params().bind_numa) {
+        std::cout << "numa nodes: " << solver.BoundNodes() << "\n";
+    }
+    std::cout << "steps: " << steps << "\n";
+    std::cout << "simulated seconds: " << solver.Time() << "\n";
+    if (params.adaptive_dt && steps > 0) {
+        std::cout << "dt: min " << *std::min_element(dts.begin(), dts.end())
+                  << ", max " << *std::max_element(dts.begin(), dts.end()) << "\n";
+    }
+    std::cout << "seconds: " << seconds << "\n";
+    std::cout << "steps/second: " << steps / seconds << "\n";
+    std::cout << "cells/second: " << cells * steps / seconds << std::endl;
+    std::vector<WorkerStats> stats = solver.GetWorkerStats();
+    for (size_t w = 0; w < stats.size(); w++) {
+        std::cout << "worker " << w << ": tiles " << stats[w].tiles
+                  << ", steals " << stats[w].steals
+                  << ", idle seconds " << stats[w].idle_seconds << "\n";
+    }
+    if (options.print_dt) {
+        for (int s = 0; s < steps; s++) {
+            std::cout << "step " << s << ": dt " << dts[s] << "\n";
+        }
+    }
+    // Rank 0's waits for the others to exit.
+    delete transport;
+}
+
+}  // namespace
+
+bool ParseRunOptions(int argc, char* argv[], RunOptions* options) {
+    SolverParams& params = options->solver_params;
+    std::vector<char*> args;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--headless") == 0) {
+            options->headless = true;
+        } else if (strcmp(argv[a], "--steps") == 0 && a + 1 < argc) {
+            options->steps = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc) {
+            params.threads = atoi(argv[++a]);
+            if (params.threads < 1) {
+                params.threads = std::thread::hardware_concurrency();
+            }
+        } else if (strcmp(argv[a], "--max-substeps") == 0 && a + 1 < argc) {
+            options->max_substeps = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--adaptive-dt") == 0) {
+            params.adaptive_dt = true;
+        } else if (strcmp(argv[a], "--cfl") == 0 && a + 1 < argc) {
+            params.adaptive_dt = true;
+            params.cfl = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--max-dt") == 0 && a + 1 < argc) {
+            params.max_dt = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--implicit-height") == 0) {
+            params.implicit_height = true;
+        } else if (strcmp(argv[a], "--multigrid-cycles") == 0 && a + 1 < argc) {
+            params.multigrid_cycles = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--print-dt") == 0) {
+            options->print_dt = true;
+        } else if (strcmp(argv[a], "--generic") == 0) {
+            params.specialize = false;
+        } else if (strcmp(argv[a], "--sparse") == 0) {
+            params.sparse = true;
+        } else if (strcmp(argv[a], "--activity-threshold") == 0 && a + 1 < argc) {
+            params.sparse = true;
+            params.activity_threshold = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--temporal-block") == 0 && a + 1 < argc) {
+            params.temporal_block = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--refine") == 0 && a + 1 < argc) {
+            params.refine = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--refine-block") == 0 && a + 1 < argc) {
+            params.refine_block = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--refine-steepness") == 0 && a + 1 < argc) {
+            params.refine_steepness = atof(argv[++a]);
+        } else if (strcmp(argv[a], "--rain") == 0 && a + 1 < argc) {
+            params.rain = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--impact-radius") == 0 && a + 1 < argc) {
+            params.impact_radius = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--ranks") == 0 && a + 1 < argc) {
+            options->ranks = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--mpi") == 0) {
+            options->mpi = true;
+        } else if (strcmp(argv[a], "--numa") == 0) {
+            params.bind_numa = true;
+        } else if (strcmp(argv[a], "--tile") == 0 && a + 1 < argc) {
+            params.tile = atoi(argv[++a]);
+        } else if (strncmp(argv[a], "--layout=", 9) == 0) {
+            if (!ParseGridLayout(argv[a] + 9, &params.layout)) {
+                std::cerr << "Unknown layout " << argv[a] + 9 << "\n";
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[a], "--advection=", 12) == 0) {
+            if (!ParseAdvection(argv[a] + 12, &params.advection)) {
+                std::cerr << "Unknown advection " << argv[a] + 12 << "\n";
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[a], "--kernel=", 9) == 0) {
+            options->kernel = argv[a] + 9;
+        } else if (strncmp(argv[a], "--precision=", 12) == 0) {
+            options->precision = argv[a] + 12;
+        } else {
+            args.push_back(argv[a]);
+        }
+    }
+    if (args.size() != 2) {
+        return false;
+    }
+    options->dimension = atoi(args[0]);
+    options->maxdrops = atoi(args[1]);
+
+    if ((options->ranks > 1 || options->mpi)
+        && (params.advection != kCentralAdvection || params.implicit_height
+            || params.tile > 0 || params.sparse
+            || params.temporal_block > 1 || params.refine > 1)) {
+        std::cerr << "--ranks and --mpi only split central advection with explicit heights,"
+                  << " without --tile, --sparse, --temporal-block or --refine\n";
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+void RunHeadless(const RunOptions& options) {
+    if (options.precision == FloatPrecision::Name()) {
+        RunPrecision<FloatPrecision>(options);
+    } else if (options.precision == DoublePrecision::Name()) {
+        RunPrecision<DoublePrecision>(options);
+    } else if (options.precision == HalfPrecision::Name()) {
+        RunPrecision<HalfPrecision>(options);
+    } else {
+        std::cerr << "Unknown precision " << options.precision << "\n";
+        exit(EXIT_FAILURE);
+    }
+}
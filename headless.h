@@ -0,0 +1,54 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// The command line both drivers share, and headless runs, which step the
+// solver as fast as it goes with no window. Nothing here touches OpenGL,
+// so build/bin/swe_run works on machines without a display.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "shallow_water.h"
+
+struct RunOptions {
+    bool headless = false;
+    int steps = 1000;
+    // Enough steps to stay in real time at 30 frames a second.
+    int max_substeps = 20;
+    bool print_dt = false;
+    int ranks = 1;
+    bool mpi = false;
+    const char* kernel = nullptr;  // nullptr keeps the best
+    std::string precision = FloatPrecision::Name();
+    SolverParams solver_params;
+    int dimension = 0;
+    int maxdrops = 0;
+};
+
+// The flags ParseRunOptions() takes, for usage lines.
+extern const char* const kRunOptionsUsage;
+
+// Fills options from argv. Returns false unless there are exactly two
+// arguments left, the dimension and maxraindrops. Exits on a flag value it
+// does not know or options the split runs cannot take.
+bool ParseRunOptions(int argc, char* argv[], RunOptions* options);
+
+// Exits if the solver cannot run the named kernels. nullptr keeps the best.
+template <typename P>
+void UseKernels(BasicShallowWaterSolver<P>& solver, const char* kernel) {
+    if (kernel != nullptr && !solver.SetKernels(kernel)) {
+        std::cerr << "Kernel " << kernel << " is not supported on this machine in "
+                  << P::Name() << "\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Steps the solver in options.precision for options.steps steps and prints
+// the throughput on rank 0. With ranks above 1 the grid is split among that
+// many processes forked here, and with mpi among the MPI ranks. Exits on an
+// unknown precision or if the ranks cannot be started.
+void RunHeadless(const RunOptions& options);
+
+#endif
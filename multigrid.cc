@@ -0,0 +1,241 @@
+#include "multigrid.h"
+
+#include <algorithm>
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
+
+#include "thread_pool.h"
+
+namespace {
+
+// Gauss-Seidel sweeps before and after each coarse correction.
+const int kSweeps = 2;
+
+// Flushes denormal results and inputs to zero on the calling thread for
+// its lifetime, where the CPU can.
+class FlushDenormals {
+    private:
+#ifdef __SSE2__
+        unsigned saved;
+    public:
+        FlushDenormals() : saved(_mm_getcsr()) { _mm_setcsr(saved | 0x8040); }
+        ~FlushDenormals() { _mm_setcsr(saved); }
+#endif
+};
+
+}  // namespace
+
+template <typename C>
+Multigrid<C>::Multigrid(int cells, ThreadPool* pool) :
+        pool(pool),
+        scratch(pool->Size(), std::vector<C>(cells + 1)) {
+    // Where each vertex of a level lies, in cells of that level.
+    std::vector<double> position;
+    for (int i = 0; i <= cells; i++) {
+        position.push_back(i);
+    }
+    for (int n = cells; ; n = (n + 1) / 2) {
+        Level l;
+        l.cells = n;
+        l.stride = n + 1;
+        size_t size = (size_t)l.stride * l.stride;
+        l.x.assign(size, C(0));
+        l.b.assign(size, C(0));
+        l.a.assign(size, C(0));
+        l.r.assign(size, C(0));
+        // The second difference on uneven spacing: the same as the 1, -2, 1
+        // stencil where both spacings are 1.
+        l.before.assign(l.stride, C(1));
+        l.after.assign(l.stride, C(1));
+        for (int i = 1; i < n; i++) {
+            double h_before = position[i] - position[i - 1];
+            double h_after = position[i + 1] - position[i];
+            l.before[i] = C(2 / ((h_before + h_after) * h_before));
+            l.after[i] = C(2 / ((h_before + h_after) * h_after));
+        }
+        levels.push_back(l);
+        if (n < 4) {
+            break;
+        }
+        std::vector<double> coarse;
+        for (int i = 0; i <= (n + 1) / 2; i++) {
+            coarse.push_back(position[std::min(2 * i, n)] / 2);
+        }
+        position.swap(coarse);
+    }
+}
+
+template <typename C>
+void Multigrid<C>::Rows(int level, int worker, int* j0, int* j1) const {
+    int interior = levels[level].cells - 1;
+    int workers = pool->Size();
+    *j0 = 1 + interior * worker / workers;
+    *j1 = 1 + interior * (worker + 1) / workers;
+}
+
+template <typename C>
+void Multigrid<C>::Solve(int cycles, int worker) {
+    // Away from the ripples the corrections decay into denormals, which
+    // would cost the smoother more than everything else.
+    FlushDenormals flush;
+    pool->Barrier();
+    Coefficients(worker);
+    for (int c = 0; c < cycles; c++) {
+        Cycle(0, worker);
+    }
+}
+
+template <typename C>
+void Multigrid<C>::Coefficients(int worker) {
+    // A coarse cell is twice as wide, so the same a covers a quarter of the
+    // Laplacian.
+    for (size_t level = 1; level < levels.size(); level++) {
+        const Level& fine = levels[level - 1];
+        Level& coarse = levels[level];
+        int j0, j1;
+        Rows((int)level, worker, &j0, &j1);
+        for (int j = j0; j < j1; j++) {
+            for (int i = 1; i < coarse.cells; i++) {
+                coarse.a[j * coarse.stride + i] = C(0.25) * fine.a[2 * j * fine.stride + 2 * i];
+            }
+        }
+        pool->Barrier();
+    }
+}
+
+template <typename C>
+void Multigrid<C>::Cycle(int level, int worker) {
+    if (level + 1 == Levels()) {
+        // As many sweeps as the grid is wide carry a correction from one
+        // edge to the other.
+        Smooth(level, levels[level].cells, worker);
+        return;
+    }
+    Smooth(level, kSweeps, worker);
+    Residual(level, worker);
+    pool->Barrier();
+    Restrict(level, worker);
+    pool->Barrier();
+    Cycle(level + 1, worker);
+    Prolong(level, worker);
+    pool->Barrier();
+    Smooth(level, kSweeps, worker);
+}
+
+template <typename C>
+void Multigrid<C>::SmoothRow(int level, int j, int colour) {
+    Level& l = levels[level];
+    const int s = l.stride;
+    C* x = &l.x[j * s];
+    const C* b = &l.b[j * s];
+    const C* a = &l.a[j * s];
+    const C* before = &l.before[0];
+    const C* after = &l.after[0];
+    C up = before[j], down = after[j];
+    for (int i = 1 + (1 + j + colour) % 2; i < l.cells; i += 2) {
+        C left = before[i], right = after[i];
+        C neighbours = left * x[i - 1] + right * x[i + 1] + up * x[i - s] + down * x[i + s];
+        x[i] = (b[i] + a[i] * neighbours) / (C(1) + (left + right + up + down) * a[i]);
+    }
+}
+
+template <typename C>
+void Multigrid<C>::Smooth(int level, int sweeps, int worker) {
+    int j0, j1;
+    Rows(level, worker, &j0, &j1);
+    for (int sweep = 0; sweep < sweeps; sweep++) {
+        // Colour 1 reads only colour 0 and the other way round, so colour
+        // 1 of row j - 1 can follow colour 0 of row j in the same pass
+        // while both rows are in cache. The first and last rows of the
+        // band, which the neighbouring bands read, get colour 0 before the
+        // barrier.
+        if (j0 < j1) {
+            SmoothRow(level, j0, 0);
+        }
+        if (j1 - 1 > j0) {
+            SmoothRow(level, j1 - 1, 0);
+        }
+        pool->Barrier();
+        for (int j = j0 + 1; j < j1; j++) {
+            if (j < j1 - 1) {
+                SmoothRow(level, j, 0);
+            }
+            SmoothRow(level, j - 1, 1);
+        }
+        if (j0 < j1) {
+            SmoothRow(level, j1 - 1, 1);
+        }
+        pool->Barrier();
+    }
+}
+
+template <typename C>
+void Multigrid<C>::Residual(int level, int worker) {
+    Level& l = levels[level];
+    const int s = l.stride;
+    int j0, j1;
+    Rows(level, worker, &j0, &j1);
+    for (int j = j0; j < j1; j++) {
+        C up = l.before[j], down = l.after[j];
+        for (int i = 1; i < l.cells; i++) {
+            int k = j * s + i;
+            C left = l.before[i], right = l.after[i];
+            C laplacian = left * (l.x[k - 1] - l.x[k]) + right * (l.x[k + 1] - l.x[k])
+                          + up * (l.x[k - s] - l.x[k]) + down * (l.x[k + s] - l.x[k]);
+            l.r[k] = l.b[k] - (l.x[k] - l.a[k] * laplacian);
+        }
+    }
+}
+
+template <typename C>
+void Multigrid<C>::Restrict(int level, int worker) {
+    const Level& fine = levels[level];
+    Level& coarse = levels[level + 1];
+    const int s = fine.stride;
+    int j0, j1;
+    Rows(level + 1, worker, &j0, &j1);
+    for (int j = j0; j < j1; j++) {
+        for (int i = 1; i < coarse.cells; i++) {
+            int k = 2 * j * s + 2 * i;
+            const C* r = &fine.r[0];
+            C sides = r[k - 1] + r[k + 1] + r[k - s] + r[k + s];
+            C corners = r[k - s - 1] + r[k - s + 1] + r[k + s - 1] + r[k + s + 1];
+            int c = j * coarse.stride + i;
+            coarse.b[c] = (C(4) * r[k] + C(2) * sides + corners) * C(1.0 / 16);
+            coarse.x[c] = 0;
+        }
+    }
+}
+
+template <typename C>
+void Multigrid<C>::Prolong(int level, int worker) {
+    Level& fine = levels[level];
+    const Level& coarse = levels[level + 1];
+    const int s = coarse.stride;
+    int j0, j1;
+    Rows(level, worker, &j0, &j1);
+    C* row = &scratch[worker][0];
+    for (int j = j0; j < j1; j++) {
+        // The coarse correction along fine row j, which averages two
+        // coarse rows if it lies between them, then along the columns.
+        const C* above = &coarse.x[j / 2 * s];
+        if (j % 2 == 0) {
+            std::copy(above, above + s, row);
+        } else {
+            for (int i = 0; i < s; i++) {
+                row[i] = C(0.5) * (above[i] + above[i + s]);
+            }
+        }
+        C* x = &fine.x[j * fine.stride];
+        for (int i = 1; i < fine.cells; i += 2) {
+            x[i] += C(0.5) * (row[i / 2] + row[i / 2 + 1]);
+        }
+        for (int i = 2; i < fine.cells; i += 2) {
+            x[i] += row[i / 2];
+        }
+    }
+}
+
+template class Multigrid<float>;
+template class Multigrid<double>;
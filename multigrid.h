@@ -0,0 +1,82 @@
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+// Geometric multigrid for the implicit height update. Solves
+//
+//     x - a * (x_left + x_right + x_up + x_down - 4 * x) = b
+//
+// for x on the vertices of a square grid, with x = 0 on the edge and a >= 0
+// given per vertex. Each V-cycle smooths with red-black Gauss-Seidel,
+// restricts the residual to a grid with half the cells by full weighting,
+// cycles there, and adds the coarse correction back by bilinear
+// interpolation. Coarse vertex I is fine vertex 2 I, or the edge where
+// that lies outside a grid with an odd side, so the last cell of such a
+// coarse grid is half as wide and the Laplacian there weighs its
+// neighbours by their distance. The coarsest level, 3 cells or fewer a
+// side, is only smoothed.
+//
+// Every worker of the ThreadPool calls Solve() from inside the same Run(),
+// and each works on a band of rows of every level with barriers between
+// the phases. A colour of Gauss-Seidel only reads the other colour, so the
+// result does not depend on the number of workers.
+
+#include <vector>
+
+class ThreadPool;
+
+// C is the type the solve computes in, float or double.
+template <typename C>
+class Multigrid {
+    private:
+        struct Level {
+            int cells;      // vertices 0 to cells on each side
+            int stride;     // cells + 1
+            // Row-major; x and r stay 0 on the edge.
+            std::vector<C> x, b, a, r;
+            // Weights of the neighbours before and after vertex i in the
+            // Laplacian, by row or column: 1 where both are a whole cell
+            // away.
+            std::vector<C> before, after;
+        };
+        std::vector<Level> levels;
+        ThreadPool* pool;
+        std::vector<std::vector<C> > scratch;  // a row per worker
+
+        // The interior rows [j0, j1) of level that worker owns.
+        void Rows(int level, int worker, int* j0, int* j1) const;
+        // Fills a of the coarse levels from the fine one.
+        void Coefficients(int worker);
+        // Gauss-Seidel on the cells of one colour of row j, those with i + j
+        // + colour even.
+        void SmoothRow(int level, int j, int colour);
+        void Smooth(int level, int sweeps, int worker);
+        // r = b - A x.
+        void Residual(int level, int worker);
+        // The residual of level becomes b of level + 1, whose x starts at 0.
+        void Restrict(int level, int worker);
+        // Adds the solution of level + 1 to x of level.
+        void Prolong(int level, int worker);
+        void Cycle(int level, int worker);
+
+        Multigrid(const Multigrid&);
+        Multigrid& operator=(const Multigrid&);
+    public:
+        // A grid of cells x cells cells, solved on pool's workers.
+        Multigrid(int cells, ThreadPool* pool);
+
+        int Levels() const { return (int)levels.size(); }
+        // The fine level's x (the first guess on entry to Solve()), b and
+        // a, (cells + 1)^2 each, row-major with Stride() between rows. The
+        // edge of x must be 0.
+        int Stride() const { return levels[0].stride; }
+        C* Solution() { return &levels[0].x[0]; }
+        C* Rhs() { return &levels[0].b[0]; }
+        C* Coefficient() { return &levels[0].a[0]; }
+
+        // Runs cycles V-cycles on the fine level. Waits for every worker to
+        // have filled its rows before it starts and to be done before it
+        // returns.
+        void Solve(int cycles, int worker);
+};
+
+#endif
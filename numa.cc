@@ -0,0 +1,74 @@
+#include "numa.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace {
+
+// Parses a sysfs cpulist such as "0-3,8-11".
+std::vector<int> ParseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        int first = 0, last = 0;
+        char dash = 0;
+        std::stringstream parts(range);
+        if (!(parts >> first)) continue;
+        last = first;
+        if (parts >> dash >> last && dash != '-') continue;
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// The CPUs of each node, skipping nodes that have none (memory-only nodes).
+std::vector<std::vector<int> > LoadNodeCpus() {
+    std::vector<std::vector<int> > nodes;
+    for (int node = 0; ; node++) {
+        std::ostringstream path;
+        path << "/sys/devices/system/node/node" << node << "/cpulist";
+        std::ifstream file(path.str().c_str());
+        if (!file) break;
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus = ParseCpuList(list);
+        if (!cpus.empty()) nodes.push_back(cpus);
+    }
+    return nodes;
+}
+
+const std::vector<std::vector<int> >& NodeCpus() {
+    static const std::vector<std::vector<int> > nodes = LoadNodeCpus();
+    return nodes;
+}
+
+}  // namespace
+
+int NumaNodes() {
+    int nodes = (int)NodeCpus().size();
+    return nodes > 0 ? nodes : 1;
+}
+
+bool BindThreadToNumaNode(int node) {
+#ifdef __linux__
+    const std::vector<std::vector<int> >& nodes = NodeCpus();
+    if (node < 0 || node >= (int)nodes.size()) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t c = 0; c < nodes[node].size(); c++) {
+        if (nodes[node][c] < CPU_SETSIZE) CPU_SET(nodes[node][c], &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return node == 0;
+#endif
+}
@@ -0,0 +1,14 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+// Minimal NUMA topology from sysfs, so binding threads to nodes needs no
+// libnuma. On systems without /sys/devices/system/node everything is one
+// node and binding is a no-op.
+
+// Number of NUMA nodes with at least one CPU, 1 if unknown.
+int NumaNodes();
+// Restricts the calling thread to the CPUs of node. Returns false if the
+// node does not exist or the affinity could not be set.
+bool BindThreadToNumaNode(int node);
+
+#endif
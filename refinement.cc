@@ -0,0 +1,497 @@
+#include "refinement.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "thread_pool.h"
+
+namespace {
+
+// Copies count values step apart in from to count values step apart in to.
+template <typename S>
+void CopyRun(const S* from, int from_step, S* to, int step, int count) {
+    for (int n = 0; n < count; n++) {
+        to[n * step] = from[n * from_step];
+    }
+}
+
+}  // namespace
+
+template <typename P>
+Refinement<P>::Refinement(int dimension, int ratio, int block, ThreadPool* pool) :
+        dimension(dimension),
+        ratio(ratio),
+        block(block),
+        blocks_x((dimension + block - 1) / block),
+        pool(pool),
+        block_patch(blocks_x * blocks_x, -1),
+        scratch(pool->Size(), std::vector<C>(ratio * block + 1)) {}
+
+template <typename P>
+void Refinement<P>::BlockCells(int bx, int* i0, int* n) const {
+    *i0 = bx * block;
+    *n = std::min(block, dimension - *i0);
+}
+
+template <typename P>
+bool Refinement<P>::Refined(int bx, int by) const {
+    if (bx < 0 || by < 0 || bx >= blocks_x || by >= blocks_x) {
+        return false;
+    }
+    return block_patch[by * blocks_x + bx] >= 0;
+}
+
+template <typename P>
+void Refinement<P>::Refine(int bx, int by) {
+    Patch p;
+    p.bx = bx;
+    p.by = by;
+    int i0, j0;
+    BlockCells(bx, &i0, &p.nx);
+    BlockCells(by, &j0, &p.ny);
+    p.stride = ratio * p.nx + 3;
+    p.plane = p.stride * (ratio * p.ny + 3);
+    p.cur = 0;
+    p.age = 0;
+    p.fresh = true;
+    p.cells.assign(7 * (size_t)p.plane, P::Store(0));
+    p.base.assign(6 * (size_t)WindowSize(p), C(0));
+    block_patch[by * blocks_x + bx] = (int)patches.size();
+    patches.push_back(p);
+}
+
+template <typename P>
+void Refinement<P>::Coarsen(int bx, int by) {
+    int index = block_patch[by * blocks_x + bx];
+    block_patch[by * blocks_x + bx] = -1;
+    if (index + 1 < (int)patches.size()) {
+        std::swap(patches[index], patches.back());
+        block_patch[patches[index].by * blocks_x + patches[index].bx] = index;
+    }
+    patches.pop_back();
+}
+
+template <typename P>
+void Refinement<P>::Clear() {
+    patches.clear();
+    std::fill(block_patch.begin(), block_patch.end(), -1);
+}
+
+template <typename P>
+bool Refinement<P>::Stepped(int bx, int by, int nx, int ny, int a, int b) const {
+    // A vertex on the edge of a block is shared with the block beyond it,
+    // and a corner with three. Past the edge of the grid there are no
+    // blocks, and the patch steps its edge as a uniform grid would.
+    int x0 = a == 0 ? bx - 1 : bx, x1 = a == ratio * nx ? bx + 1 : bx;
+    int y0 = b == 0 ? by - 1 : by, y1 = b == ratio * ny ? by + 1 : by;
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, blocks_x - 1);
+    y1 = std::min(y1, blocks_x - 1);
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            if (!Refined(x, y)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename P>
+void Refinement<P>::Connect() {
+    for (size_t index = 0; index < patches.size(); index++) {
+        Patch& p = patches[index];
+        int wide = ratio * p.nx, high = ratio * p.ny;
+        p.row_begin.assign(high + 1, 0);
+        p.row_end.assign(high + 1, 0);
+        p.interfaces.clear();
+        p.ghosts.clear();
+        for (int b = 0; b <= high; b++) {
+            // The stepped vertices of a row are contiguous: the interior
+            // ones go together, and each end vertex joins them or not.
+            if (!Stepped(p.bx, p.by, p.nx, p.ny, 1, b)) {
+                continue;
+            }
+            p.row_begin[b] = Stepped(p.bx, p.by, p.nx, p.ny, 0, b) ? 0 : 1;
+            p.row_end[b] = Stepped(p.bx, p.by, p.nx, p.ny, wide, b) ? wide + 1 : wide;
+        }
+        for (int b = 0; b <= high; b++) {
+            for (int a = 0; a <= wide; a++) {
+                if (a >= p.row_begin[b] && a < p.row_end[b]) {
+                    continue;
+                }
+                Interface f;
+                int x0 = std::min(a / ratio, p.nx - 1), y0 = std::min(b / ratio, p.ny - 1);
+                f.cell = Cell(p, a, b);
+                f.base = y0 * (p.nx + 1) + x0;
+                f.fx = C(a - ratio * x0) / C(ratio);
+                f.fy = C(b - ratio * y0) / C(ratio);
+                p.interfaces.push_back(f);
+            }
+        }
+        // A stepped vertex on the edge of the patch reads one vertex past it.
+        for (int b = 0; b <= high; b++) {
+            if (p.row_begin[b] == 0 && p.row_end[b] > 0) {
+                AddGhost((int)index, -1, b, -1, 0);
+            }
+            if (p.row_end[b] == wide + 1) {
+                AddGhost((int)index, wide + 1, b, 1, 0);
+            }
+        }
+        for (int a = p.row_begin[0]; a < p.row_end[0]; a++) {
+            AddGhost((int)index, a, -1, 0, -1);
+        }
+        for (int a = p.row_begin[high]; a < p.row_end[high]; a++) {
+            AddGhost((int)index, a, high + 1, 0, 1);
+        }
+    }
+}
+
+template <typename P>
+void Refinement<P>::AddGhost(int index, int a, int b, int dx, int dy) {
+    // The neighbouring patch steps the vertex too. Past the edge of the
+    // grid the ghost mirrors the edge, as the grid's own ghosts do.
+    Patch& p = patches[index];
+    Ghost g;
+    g.cell = Cell(p, a, b);
+    g.count = 1;
+    int bx = p.bx + dx, by = p.by + dy;
+    if (bx < 0 || by < 0 || bx >= blocks_x || by >= blocks_x) {
+        g.patch = index;
+        g.from = Cell(p, a - dx, b - dy);
+    } else {
+        g.patch = block_patch[by * blocks_x + bx];
+        const Patch& q = patches[g.patch];
+        int qa = dx < 0 ? a + ratio * q.nx : dx > 0 ? a - ratio * p.nx : a;
+        int qb = dy < 0 ? b + ratio * q.ny : dy > 0 ? b - ratio * p.ny : b;
+        g.from = Cell(q, qa, qb);
+    }
+    // The ghosts of an edge run down a column or along a row of both
+    // patches, and continue the run before them where they can.
+    g.step = dx != 0 ? p.stride : 1;
+    g.from_step = dx != 0 ? patches[g.patch].stride : 1;
+    if (!p.ghosts.empty()) {
+        Ghost& last = p.ghosts.back();
+        if (last.patch == g.patch && last.step == g.step && last.from_step == g.from_step
+            && last.cell + last.count * last.step == g.cell
+            && last.from + last.count * last.from_step == g.from) {
+            last.count++;
+            return;
+        }
+    }
+    p.ghosts.push_back(g);
+}
+
+template <typename P>
+long Refinement<P>::SteppedVertices() const {
+    long vertices = 0;
+    for (size_t index = 0; index < patches.size(); index++) {
+        const Patch& p = patches[index];
+        for (size_t b = 0; b < p.row_begin.size(); b++) {
+            vertices += p.row_end[b] - p.row_begin[b];
+        }
+    }
+    return vertices;
+}
+
+template <typename P>
+void Refinement<P>::PatchBlock(int p, int* bx, int* by) const {
+    *bx = patches[p].bx;
+    *by = patches[p].by;
+}
+
+template <typename P>
+typename P::Compute* Refinement<P>::Window(int p, bool end, Field f) {
+    Patch& patch = patches[p];
+    return &patch.base[((end ? 3 : 0) + f) * (size_t)WindowSize(patch)];
+}
+
+template <typename P>
+void Refinement<P>::Prolong() {
+    for (size_t index = 0; index < patches.size(); index++) {
+        Patch& p = patches[index];
+        if (!p.fresh) {
+            continue;
+        }
+        p.fresh = false;
+        // Every vertex of the patch, as if none were stepped.
+        int w = p.nx + 1;
+        for (int f = 0; f < 3; f++) {
+            const C* window = Window((int)index, false, Field(f));
+            S* plane = Plane(p, p.cur, Field(f));
+            for (int b = 0; b <= ratio * p.ny; b++) {
+                int y0 = std::min(b / ratio, p.ny - 1);
+                C fy = C(b - ratio * y0) / C(ratio);
+                for (int a = 0; a <= ratio * p.nx; a++) {
+                    int x0 = std::min(a / ratio, p.nx - 1);
+                    C fx = C(a - ratio * x0) / C(ratio);
+                    const C* corner = window + y0 * w + x0;
+                    C top = corner[0] + (corner[1] - corner[0]) * fx;
+                    C bottom = corner[w] + (corner[w + 1] - corner[w]) * fx;
+                    plane[Cell(p, a, b)] = P::Store(top + (bottom - top) * fy);
+                }
+            }
+        }
+    }
+}
+
+template <typename P>
+typename P::Compute Refinement<P>::Steepness(int p, int X0, int Y0, int X1, int Y1) const {
+    const Patch& patch = patches[p];
+    const S* h = &patch.cells[patch.cur * 3 * patch.plane];
+    int ax = ratio * patch.bx * block, ay = ratio * patch.by * block;
+    int high = ratio * patch.ny;
+    C steepest = 0;
+    for (int b = std::max(Y0 - ay, 0); b <= std::min(Y1 - ay, high); b++) {
+        int begin = std::max(patch.row_begin[b], X0 - ax);
+        int end = std::min(patch.row_end[b], X1 - ax + 1);
+        for (int a = begin; a < end; a++) {
+            int cell = Cell(patch, a, b);
+            C here = P::Load(h[cell]);
+            if (a + 1 < end) {
+                steepest = std::max(steepest, std::abs(P::Load(h[cell + 1]) - here));
+            }
+            if (b < high && b + ay < Y1 && a >= patch.row_begin[b + 1]
+                    && a < patch.row_end[b + 1]) {
+                steepest = std::max(steepest, std::abs(P::Load(h[cell + patch.stride]) - here));
+            }
+        }
+    }
+    return steepest * C(ratio);
+}
+
+template <typename P>
+void Refinement<P>::Impact(int X, int Y, C force) {
+    // A vertex on the edge of a block is stepped by every patch that
+    // shares it, and each needs the force.
+    int side = ratio * block;
+    for (int by = (Y - 1) / side; by <= Y / side; by++) {
+        for (int bx = (X - 1) / side; bx <= X / side; bx++) {
+            if (!Refined(bx, by)) {
+                continue;
+            }
+            Patch& p = patches[block_patch[by * blocks_x + bx]];
+            int a = X - bx * side, b = Y - by * side;
+            if (a < 0 || b < 0 || a > ratio * p.nx || b > ratio * p.ny
+                    || a < p.row_begin[b] || a >= p.row_end[b]) {
+                continue;
+            }
+            Forces(p)[Cell(p, a, b)] = P::Store(force);
+        }
+    }
+}
+
+template <typename P>
+void Refinement<P>::InterpolateInterfaces(Patch& p) {
+    if (p.interfaces.empty()) {
+        return;
+    }
+    int w = p.nx + 1;
+    int size = WindowSize(p);
+    p.edge.resize(6 * p.interfaces.size());
+    for (int f = 0; f < 6; f++) {
+        const C* window = &p.base[f * size];
+        C* edge = &p.edge[f * p.interfaces.size()];
+        for (size_t k = 0; k < p.interfaces.size(); k++) {
+            const Interface& v = p.interfaces[k];
+            const C* x = window + v.base;
+            C top = x[0] + (x[1] - x[0]) * v.fx;
+            C bottom = x[w] + (x[w + 1] - x[w]) * v.fx;
+            edge[k] = top + (bottom - top) * v.fy;
+        }
+    }
+}
+
+template <typename P>
+void Refinement<P>::FillInterfaces(Patch& p, int buffer, C theta, bool height) {
+    size_t n = p.interfaces.size();
+    if (n == 0) {
+        return;
+    }
+    for (int f = height ? 0 : 1; f < 3; f++) {
+        const C* before = &p.edge[f * n];
+        const C* after = &p.edge[(3 + f) * n];
+        S* plane = Plane(p, buffer, Field(f));
+        for (size_t k = 0; k < n; k++) {
+            plane[p.interfaces[k].cell] = P::Store(before[k] + (after[k] - before[k]) * theta);
+        }
+    }
+}
+
+template <typename P>
+void Refinement<P>::FillGhosts(Patch& p, bool next, bool height_and_forces) {
+    int mine = next ? 1 - p.cur : p.cur;
+    for (size_t k = 0; k < p.ghosts.size(); k++) {
+        const Ghost& g = p.ghosts[k];
+        Patch& from = patches[g.patch];
+        int theirs = next ? 1 - from.cur : from.cur;
+        for (int f = height_and_forces ? 0 : 1; f < 3; f++) {
+            CopyRun(Plane(from, theirs, Field(f)) + g.from, g.from_step,
+                    Plane(p, mine, Field(f)) + g.cell, g.step, g.count);
+        }
+        if (height_and_forces) {
+            CopyRun(Forces(from) + g.from, g.from_step, Forces(p) + g.cell, g.step, g.count);
+        }
+    }
+}
+
+template <typename P>
+void Refinement<P>::VelocityRows(Patch& p, const KernelTable<P>* kernels,
+                                 const StencilConstants<C>& c) {
+    const int s = p.stride;
+    const S* height = Plane(p, p.cur, kHeight);
+    const S* u = Plane(p, p.cur, kU);
+    const S* v = Plane(p, p.cur, kV);
+    const S* force = Forces(p);
+    S* u_out = Plane(p, 1 - p.cur, kU);
+    S* v_out = Plane(p, 1 - p.cur, kV);
+    for (size_t b = 0; b < p.row_begin.size(); b++) {
+        if (p.row_begin[b] == p.row_end[b]) {
+            continue;
+        }
+        // Row pointers at vertex a = -1, so columns are a + 1.
+        int row = ((int)b + 1) * s;
+        VelocityRowArgs<S> r;
+        r.height      = height + row;
+        r.height_up   = height + row - s;
+        r.height_down = height + row + s;
+        r.force       = force + row;
+        r.force_up    = force + row - s;
+        r.force_down  = force + row + s;
+        r.u           = u + row;
+        r.u_up        = u + row - s;
+        r.u_down      = u + row + s;
+        r.v           = v + row;
+        r.v_up        = v + row - s;
+        r.v_down      = v + row + s;
+        r.u_out       = u_out + row;
+        r.v_out       = v_out + row;
+        kernels->velocity_row(r, c, p.row_begin[b] + 1, p.row_end[b] + 1, nullptr);
+    }
+}
+
+template <typename P>
+void Refinement<P>::HeightRows(Patch& p, const KernelTable<P>* kernels,
+                               const StencilConstants<C>& c) {
+    const int s = p.stride;
+    const S* height = Plane(p, p.cur, kHeight);
+    const S* u = Plane(p, 1 - p.cur, kU);
+    const S* v = Plane(p, 1 - p.cur, kV);
+    S* height_out = Plane(p, 1 - p.cur, kHeight);
+    S* force = Forces(p);
+    // Heights on the edge of the grid stay as they are.
+    int high = ratio * p.ny;
+    int b0 = p.by == 0 ? 1 : 0, b1 = p.by == blocks_x - 1 ? high : high + 1;
+    int a0 = p.bx == 0 ? 1 : 0, a1 = p.bx == blocks_x - 1 ? ratio * p.nx : ratio * p.nx + 1;
+    for (int b = b0; b < b1; b++) {
+        int begin = std::max(p.row_begin[b], a0), end = std::min(p.row_end[b], a1);
+        if (begin >= end) {
+            continue;
+        }
+        int row = (b + 1) * s;
+        HeightRowArgs<S> r;
+        r.height      = height + row;
+        r.height_up   = height + row - s;
+        r.height_down = height + row + s;
+        r.u           = u + row;
+        r.v           = v + row;
+        r.v_up        = v + row - s;
+        r.v_down      = v + row + s;
+        r.height_out  = height_out + row;
+        r.force       = force + row;
+        kernels->height_row(r, c, begin + 1, end + 1);
+    }
+}
+
+template <typename P>
+void Refinement<P>::Restrict(Patch& p, int buffer, int worker) {
+    // Fine vertex ratio * k + d weighs ratio - |d| in each direction, and
+    // the weights of a direction add up to ratio^2. The fine rows around
+    // each base row are summed into scratch first, which runs along whole
+    // rows, then along that sum.
+    int w = p.nx + 1;
+    int size = WindowSize(p);
+    int wide = ratio * p.nx + 1;
+    C norm = C(1) / C(ratio * ratio * ratio * ratio);
+    C* column = &scratch[worker][0];
+    for (int f = 0; f < 3; f++) {
+        const S* plane = Plane(p, buffer, Field(f));
+        C* end = &p.base[(3 + f) * size];
+        for (int l = 1; l < p.ny; l++) {
+            std::fill(column, column + wide, C(0));
+            for (int dy = 1 - ratio; dy < ratio; dy++) {
+                const S* fine = plane + Cell(p, 0, ratio * l + dy);
+                C weight = C(ratio - std::abs(dy));
+                for (int a = 0; a < wide; a++) {
+                    column[a] += weight * P::Load(fine[a]);
+                }
+            }
+            for (int k = 1; k < p.nx; k++) {
+                C sum = 0;
+                for (int dx = 1 - ratio; dx < ratio; dx++) {
+                    sum += C(ratio - std::abs(dx)) * column[ratio * k + dx];
+                }
+                end[l * w + k] = sum * norm;
+            }
+        }
+    }
+}
+
+template <typename P>
+void Refinement<P>::Advance(const KernelTable<P>* kernels, const StencilConstants<C>& fine) {
+    pool->Run([this, kernels, &fine](int worker) {
+        int workers = pool->Size();
+        int count = (int)patches.size();
+        for (int k = worker; k < count; k += workers) {
+            InterpolateInterfaces(patches[k]);
+        }
+        for (int step = 0; step < ratio; step++) {
+            // Each half of a substep reads what the other patches wrote in
+            // the half before it, from the buffer they do not write now, so
+            // a patch takes its ghosts just before it is stepped.
+            for (int k = worker; k < count; k += workers) {
+                Patch& p = patches[k];
+                FillGhosts(p, false, true);
+                FillInterfaces(p, p.cur, C(step) / C(ratio), true);
+                VelocityRows(p, kernels, fine);
+            }
+            pool->Barrier();
+            for (int k = worker; k < count; k += workers) {
+                Patch& p = patches[k];
+                FillGhosts(p, true, false);
+                FillInterfaces(p, 1 - p.cur, C(step + 1) / C(ratio), false);
+                HeightRows(p, kernels, fine);
+                if (step == ratio - 1) {
+                    Restrict(p, 1 - p.cur, worker);
+                    p.age++;
+                }
+            }
+            pool->Barrier();
+            for (int k = worker; k < count; k += workers) {
+                patches[k].cur = 1 - patches[k].cur;
+            }
+            pool->Barrier();
+        }
+    });
+}
+
+template <typename P>
+void Refinement<P>::CopyHeight(float* out) const {
+    int side = ratio * dimension + 1;
+    for (size_t index = 0; index < patches.size(); index++) {
+        const Patch& p = patches[index];
+        const S* h = &p.cells[p.cur * 3 * p.plane];
+        int a0 = ratio * p.bx * block, b0 = ratio * p.by * block;
+        for (size_t b = 0; b < p.row_begin.size(); b++) {
+            for (int a = p.row_begin[b]; a < p.row_end[b]; a++) {
+                out[(b0 + b) * side + a0 + a] = P::Load(h[Cell(p, a, (int)b)]);
+            }
+        }
+    }
+}
+
+template class Refinement<FloatPrecision>;
+template class Refinement<DoublePrecision>;
+template class Refinement<HalfPrecision>;
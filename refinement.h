@@ -0,0 +1,168 @@
+#ifndef REFINEMENT_H
+#define REFINEMENT_H
+
+// Adaptive mesh refinement for the rain pool. The solver's grid is the base
+// level. It is cut into square blocks of base cells, and a block where a
+// drop lands or the water is steep gets a patch refined ratio times in
+// space and time. The patch is removed again when the water there flattens
+// out.
+//
+// Patches step after the base level has taken its step. Each takes ratio
+// substeps of dt / ratio on cells dwater / ratio wide, with the same row
+// kernels as the base level. A patch vertex is stepped when every block
+// that shares it is refined. The other vertices take the base level's
+// values: bilinear in space, and linear in time between the start and end
+// of the step. Neighbouring patches exchange ghost cells before each half
+// of a substep, so a ripple crosses from one to the next as it would on a
+// uniform fine grid. After the substeps, each base vertex inside a patch
+// takes the weighted average of the fine vertices around it (the transpose
+// of the interpolation). That is how ripples leave the patches.
+//
+// The solver talks to the base level through each patch's window: the
+// base vertices [i0, i0 + nx] x [j0, j0 + ny] under it, in the compute
+// precision.
+
+#include <vector>
+
+#include "swe_kernels.h"
+
+class ThreadPool;
+
+template <typename P>
+class Refinement {
+    public:
+        typedef typename P::Storage S;
+        typedef typename P::Compute C;
+        // The planes of a window, at the start of the step and at its end.
+        enum Field { kHeight, kU, kV };
+    private:
+        // A run of count ghost cells of a patch, step apart, and the
+        // vertices of a neighbouring patch they copy, from_step apart.
+        struct Ghost {
+            int cell;
+            int patch;
+            int from;
+            int count;
+            int step, from_step;
+        };
+        // A vertex that is not stepped: the window vertex before it and how
+        // far it lies towards the next one, in base cells.
+        struct Interface {
+            int cell;
+            int base;
+            C fx, fy;
+        };
+        // Patch vertex (a, b), for a in [-1, ratio * nx + 1] and b likewise,
+        // is cell (b + 1) * stride + a + 1 of each plane. The rows and
+        // columns at -1 and ratio * n + 1 are ghosts.
+        struct Patch {
+            int bx, by;
+            int nx, ny;          // base cells across and down
+            int stride;
+            int plane;           // cells per plane
+            int cur;             // which buffer holds the current state
+            int age;             // steps taken
+            bool fresh;          // not yet filled by Prolong()
+            // Height, u and v in two buffers each, then the forces.
+            std::vector<S> cells;
+            // The window: height, u and v at the start of the step, then at
+            // its end, (nx + 1) x (ny + 1) each, row-major.
+            std::vector<C> base;
+            // Set by Connect(): the stepped columns [row_begin[b],
+            // row_end[b]) of each row b in [0, ratio * ny], the vertices that
+            // take the base level's values and the ghosts.
+            std::vector<int> row_begin, row_end;
+            std::vector<Interface> interfaces;
+            std::vector<Ghost> ghosts;
+            // Height, u and v of each interface at the start of the step,
+            // then at its end.
+            std::vector<C> edge;
+        };
+        int dimension;
+        int ratio;
+        int block;
+        int blocks_x;
+        ThreadPool* pool;
+        std::vector<Patch> patches;
+        std::vector<int> block_patch;  // the patch of each block, -1 if none
+        std::vector<std::vector<C> > scratch;  // a patch row per worker
+
+        S* Plane(Patch& p, int buffer, Field f) {
+            return &p.cells[(buffer * 3 + f) * p.plane];
+        }
+        S* Forces(Patch& p) { return &p.cells[6 * p.plane]; }
+        int Cell(const Patch& p, int a, int b) const { return (b + 1) * p.stride + a + 1; }
+        int WindowSize(const Patch& p) const { return (p.nx + 1) * (p.ny + 1); }
+        // Whether patch vertex (a, b) of block (bx, by) is stepped: every
+        // block that shares it is refined.
+        bool Stepped(int bx, int by, int nx, int ny, int a, int b) const;
+        // Adds ghost (a, b) of patch index, which lies past its edge in
+        // direction (dx, dy).
+        void AddGhost(int index, int a, int b, int dx, int dy);
+        // Interpolates the windows of p onto its interfaces.
+        void InterpolateInterfaces(Patch& p);
+        // Fills the vertices of p that are not stepped with the base
+        // level's fields at fraction theta of the step, into buffer.
+        void FillInterfaces(Patch& p, int buffer, C theta, bool height);
+        // Copies the ghosts of fields from the neighbours' buffers.
+        void FillGhosts(Patch& p, bool next, bool height_and_forces);
+        void VelocityRows(Patch& p, const KernelTable<P>* kernels,
+                          const StencilConstants<C>& c);
+        void HeightRows(Patch& p, const KernelTable<P>* kernels,
+                        const StencilConstants<C>& c);
+        // Averages the fine fields of buffer onto the base vertices inside
+        // p, into the end of the window.
+        void Restrict(Patch& p, int buffer, int worker);
+
+        bool Refined(int bx, int by) const;
+
+        Refinement(const Refinement&);
+        Refinement& operator=(const Refinement&);
+    public:
+        // Refines a grid of dimension cells ratio times, in blocks of block
+        // cells a side (smaller at the far edges if block does not divide
+        // dimension), stepping the patches on pool's workers.
+        Refinement(int dimension, int ratio, int block, ThreadPool* pool);
+
+        int Ratio() const { return ratio; }
+        int BlocksX() const { return blocks_x; }
+        // Base cells [*i0, *i0 + *n) of block column bx, or of block row bx.
+        void BlockCells(int bx, int* i0, int* n) const;
+        // The patch of block (bx, by), -1 if the block is not refined.
+        // Adding a patch keeps the others' indices, removing one does not.
+        int PatchOf(int bx, int by) const { return block_patch[by * blocks_x + bx]; }
+        // Adds and removes patches. Call Connect() after the last change and
+        // fill the window of a new patch before Prolong().
+        void Refine(int bx, int by);
+        void Coarsen(int bx, int by);
+        void Connect();
+        // Removes every patch.
+        void Clear();
+
+        int Patches() const { return (int)patches.size(); }
+        // Fine vertices the patches step.
+        long SteppedVertices() const;
+        void PatchBlock(int p, int* bx, int* by) const;
+        // Field f of patch p's window at the start or the end of the step.
+        C* Window(int p, bool end, Field f);
+        // Fills the new patches from the start of their windows.
+        void Prolong();
+        // Steps patch p has taken since it was added.
+        int Age(int p) const { return patches[p].age; }
+        // The largest height difference between neighbours that patch p
+        // steps among fine vertices [X0, X1] x [Y0, Y1] of the whole grid,
+        // per base cell.
+        C Steepness(int p, int X0, int Y0, int X1, int Y1) const;
+        // Puts force on fine vertex (X, Y) for the next substep, in every
+        // patch that steps it.
+        void Impact(int X, int Y, C force);
+        // Takes the substeps of one base step with the constants of the
+        // fine grid, then leaves the averages in the end of the windows.
+        // Runs every worker of the pool.
+        void Advance(const KernelTable<P>* kernels, const StencilConstants<C>& fine);
+        // Copies the heights of the stepped vertices into out, a row-major
+        // grid of ratio * dimension + 1 vertices a side.
+        void CopyHeight(float* out) const;
+};
+
+#endif
@@ -2,4 +2,4 @@
 if [ ! -d "build" ]; then
   ./buildit.sh
 fi
-build/bin/assignment $1 $2
+build/bin/assignment "$@"
@@ -0,0 +1,1698 @@
+#include "shallow_water.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+#include "halo_transport.h"
+#include "numa.h"
+#include "swe_stencil.h"
+#include "thread_pool.h"
+
+namespace {
+
+int RoundUp(int n, int multiple) {
+    return (n + multiple - 1) / multiple * multiple;
+}
+
+// Tile sides for params.sparse and params.temporal_block when params.tile
+// leaves them to the solver.
+const int kSparseTile = 64;
+const int kTemporalTile = 256;
+
+// With params.refine: steps between regrids, and how far from a block a
+// ripple steeper than the threshold gets it refined. A ripple crosses at
+// most about half a cell per step, so it cannot leave the reach between
+// regrids. A drop refines the blocks within kImpactReach cells of it, so
+// the patches step the cells its force reaches.
+const int kRegridInterval = 8;
+const int kRegridReach = 4;
+const int kImpactReach = 2;
+
+// With a transport: rows each rank takes from the band on either side of
+// its own. A new velocity reads the state one row out, and a new height the
+// new velocities one row out.
+const int kHaloRows = 2;
+
+// Landed drops are sorted into square buckets of cells this wide, so the
+// pushes are applied one small patch of the force plane at a time instead of
+// wherever the drops happen to land. Below kParallelImpacts drops in a step,
+// the calling thread applies them alone.
+const int kImpactBucket = 32;
+const int kParallelImpacts = 256;
+
+}  // namespace
+
+template <typename P>
+BasicShallowWaterSolver<P>::BasicShallowWaterSolver(int dimension, int maxdrops,
+                                       const SolverParams& params) :
+        params(params),
+        dimension(dimension),
+        dimension_plus(dimension + 1),
+        dimension_plus_2((dimension + 1) * (dimension + 1)),
+        halo(params.halo),
+        maxdrops(maxdrops),
+        dwater(params.water_len / dimension),
+        time(0.0f),
+        dt(params.dt),
+        kernels(BestKernels<P>()),
+        fixed(nullptr),
+        pool(new ThreadPool(params.threads)),
+        bound_nodes(0),
+        scheduler(nullptr),
+        multigrid(nullptr),
+        tiles_x(0),
+        sparse(params.sparse && !params.implicit_height),
+        temporal_block(1),
+        impact_buckets_x((dimension + kImpactBucket) / kImpactBucket),
+        refinement(nullptr),
+        regrid_countdown(0),
+        transport(nullptr) {
+    // Each row is [padding][halo ghosts][dimension_plus cells][halo ghosts]
+    // [padding], with the left padding sized so the first real cell of
+    // every row lands on an alignment boundary.
+    const int align = kPlaneAlignment / sizeof(S);
+    int lead = RoundUp(halo, align);
+    if (params.layout == kRowMajor) {
+        rows.stride = RowStride(dimension_plus, halo, align);
+        plane_rows = dimension_plus + 2 * halo;
+        plane_size = plane_rows * rows.stride;
+        plane_origin = halo * rows.stride + lead;
+    } else {
+        // The same padded rows cut into blocks, so column 0 starts a block
+        // row on an alignment boundary.
+        const int block = BlockLayout::kBlock;
+        int blocks_y = (dimension_plus + 2 * halo + block - 1) / block;
+        blocks.shift_x = lead;
+        blocks.shift_y = halo;
+        blocks.blocks_x = (lead + dimension_plus + halo + block - 1) / block;
+        block_offsets = BlockOffsets(params.layout, blocks.blocks_x, blocks_y,
+                                     block * block);
+        blocks.block_offset = &block_offsets[0];
+        plane_rows = blocks_y * block;
+        plane_size = blocks.blocks_x * blocks_y * block * block;
+        plane_origin = 0;
+    }
+
+    if (params.bind_numa) {
+        // Workers go to nodes in contiguous runs so neighbouring bands,
+        // which read each other's edge rows, mostly share a node.
+        int nodes = NumaNodes();
+        std::atomic<bool> bound(true);
+        pool->Run([this, nodes, &bound](int worker) {
+            if (!BindThreadToNumaNode(worker * nodes / pool->Size())) {
+                bound = false;
+            }
+        });
+        bound_nodes = bound ? nodes : 0;
+    }
+
+    water_height_curr = AllocPlane();
+    water_height_prev = AllocPlane();
+    water_u_curr      = AllocPlane();
+    water_u_prev      = AllocPlane();
+    water_v_curr      = AllocPlane();
+    water_v_prev      = AllocPlane();
+    water_forces      = AllocPlane();
+    rain_drops        = new float [maxdrops * 4];
+    rain_speeds       = new float [maxdrops];
+
+    // A Gaussian with a standard deviation of half the radius, cut off
+    // past the radius.
+    int r = std::max(params.impact_radius, 0);
+    for (int dy = -r; dy <= r; dy++) {
+        for (int dx = -r; dx <= r; dx++) {
+            int d2 = dx * dx + dy * dy;
+            C weight = d2 == 0 ? C(1) : d2 <= r * r ? C(std::exp(-2.0 * d2 / (r * r))) : C(0);
+            splat.push_back(C(params.forceconst) * weight);
+        }
+    }
+
+    if (params.temporal_block > 1 && params.advection == kCentralAdvection
+            && !params.implicit_height && !sparse) {
+        temporal_block = params.temporal_block;
+    }
+    // A rank owns rows [first, last), split into one contiguous band per
+    // worker.
+    int first = 0, last = dimension_plus;
+    HaloTransport* t = params.transport;
+    if (t != nullptr && params.advection == kCentralAdvection && !params.implicit_height
+            && params.tile == 0 && !sparse && temporal_block == 1
+            && dimension_plus >= kHaloRows * t->Size()) {
+        transport = t;
+        first = dimension_plus * t->Rank() / t->Size();
+        last = dimension_plus * (t->Rank() + 1) / t->Size();
+        halo_send.resize(2 * HaloBytes(dimension) / sizeof(S));
+        halo_recv.resize(halo_send.size());
+    }
+    int workers = pool->Size();
+    worker_bounds.resize(workers);
+    for (int w = 0; w <= workers; w++) {
+        bands.push_back(first + (last - first) * w / workers);
+    }
+    // Bands are swept one strip of columns at a time, so with blocks a
+    // sweep stays inside one column of blocks instead of crossing every
+    // block of the grid on each row.
+    if (params.layout == kRowMajor) {
+        strips.push_back(0);
+        strips.push_back(dimension_plus);
+    } else {
+        strips = BlockEdges(blocks.shift_x, BlockLayout::kBlock);
+    }
+    if (params.tile > 0 || sparse || temporal_block > 1) {
+        // Tiles split the rows and columns as evenly as they can, or on
+        // block edges when there are blocks. At least two cells a side keep
+        // a tile's frame columns distinct.
+        int side = params.tile > 0 ? params.tile : sparse ? kSparseTile : kTemporalTile;
+        side = std::max(side, 4);
+        if (params.layout == kRowMajor) {
+            int count = (dimension_plus + side - 1) / side;
+            for (int t = 0; t <= count; t++) {
+                tile_rows.push_back(dimension_plus * t / count);
+            }
+            tile_cols = tile_rows;
+        } else {
+            side = RoundUp(side, BlockLayout::kBlock);
+            tile_rows = BlockEdges(blocks.shift_y, side);
+            tile_cols = BlockEdges(blocks.shift_x, side);
+        }
+        tiles_x = (int)tile_cols.size() - 1;
+        scheduler = new TileScheduler(workers, 3);
+        if (sparse) {
+            int tiles = Tiles();
+            tile_hot.resize(tiles);
+            tile_active.resize(tiles);
+            tile_flatten.resize(tiles);
+            active_tiles.reserve(tiles);
+        }
+    }
+    if (temporal_block > 1) {
+        // Room for the widest tile, its margin and a ghost cell each side.
+        // Each worker first touches its own planes.
+        int widest = 0;
+        for (size_t t = 0; t + 1 < tile_rows.size(); t++) {
+            widest = std::max(widest, tile_rows[t + 1] - tile_rows[t]);
+        }
+        for (size_t t = 0; t + 1 < tile_cols.size(); t++) {
+            widest = std::max(widest, tile_cols[t + 1] - tile_cols[t]);
+        }
+        int side = widest + 4 * temporal_block + 2;
+        block_planes.resize(workers);
+        pool->Run([this, side, align](int worker) {
+            BlockPlanes& b = block_planes[worker];
+            b.stride = RoundUp(side, align);
+            b.plane = b.stride * side;
+            b.cells.assign(7 * (size_t)b.plane, P::Store(0));
+        });
+    }
+    if (params.implicit_height) {
+        multigrid = new Multigrid<C>(dimension, pool);
+    }
+    SetRefine(params.refine);
+    SelectFixed();
+    Init();
+}
+
+template <typename P>
+BasicShallowWaterSolver<P>::~BasicShallowWaterSolver() {
+    FreePlane(water_height_curr);
+    FreePlane(water_height_prev);
+    FreePlane(water_u_curr);
+    FreePlane(water_u_prev);
+    FreePlane(water_v_curr);
+    FreePlane(water_v_prev);
+    FreePlane(water_forces);
+    delete [] rain_drops;
+    delete [] rain_speeds;
+    delete scheduler;
+    delete multigrid;
+    delete refinement;
+    delete pool;
+}
+
+template <typename P>
+typename P::Storage* BasicShallowWaterSolver<P>::AllocPlane() {
+    void* plane = nullptr;
+    if (posix_memalign(&plane, kPlaneAlignment, sizeof(S) * plane_size) != 0) {
+        throw std::bad_alloc();
+    }
+    return static_cast<S*>(plane) + plane_origin;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::FreePlane(S* plane) {
+    free(plane - plane_origin);
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::FillRows(S* plane, int r0, int r1, C value) {
+    S* base = plane - plane_origin;
+    S stored = P::Store(value);
+    if (params.layout == kRowMajor) {
+        std::fill(base + r0 * rows.stride, base + r1 * rows.stride, stored);
+        return;
+    }
+    const int block = BlockLayout::kBlock;
+    for (int y = r0; y < r1; y++) {
+        for (int bx = 0; bx < blocks.blocks_x; bx++) {
+            S* run = base + block_offsets[y / block * blocks.blocks_x + bx]
+                     + y % block * block;
+            std::fill(run, run + block, stored);
+        }
+    }
+}
+
+template <typename P>
+std::vector<int> BasicShallowWaterSolver<P>::BlockEdges(int shift, int side) const {
+    // Cuts [0, dimension_plus) where cell + shift is a multiple of side,
+    // leaving out cuts that would make a piece at either end narrower than
+    // two cells.
+    std::vector<int> edges(1, 0);
+    for (int e = side - shift % side; e < dimension_plus; e += side) {
+        if (e >= 2 && dimension_plus - e >= 2) {
+            edges.push_back(e);
+        }
+    }
+    edges.push_back(dimension_plus);
+    return edges;
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::Offset(int i, int j) const {
+    return params.layout == kRowMajor ? rows.Index(i, j) : blocks.Index(i, j);
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::RunEnd(int i) const {
+    return params.layout == kRowMajor ? rows.RunEnd(i) : blocks.RunEnd(i);
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::Init() {
+    pool->Run([this](int worker) {
+        // The first and last workers also take the ghost rows above and
+        // below their bands, or the halo rows where another rank's band
+        // lies beyond.
+        int first = bands.front(), last = bands.back();
+        int r0 = worker > 0 ? bands[worker] + halo
+                 : first > 0 ? first - kHaloRows + halo : 0;
+        int r1 = worker < pool->Size() - 1 ? bands[worker + 1] + halo
+                 : last < dimension_plus ? last + kHaloRows + halo : plane_rows;
+        FillRows(water_height_curr, r0, r1, 0);
+        FillRows(water_height_prev, r0, r1, 0);
+        FillRows(water_u_curr, r0, r1, 0);
+        FillRows(water_u_prev, r0, r1, 0);
+        FillRows(water_v_curr, r0, r1, 0);
+        FillRows(water_v_prev, r0, r1, 0);
+        FillRows(water_forces, r0, r1, 0);
+    });
+    std::fill(rain_drops, rain_drops + maxdrops * 4, 0.0f);
+    std::fill(rain_speeds, rain_speeds + maxdrops, 0.0f);
+    numdrops = 0;
+    head = 0;
+    tail = 0;
+    time = 0.0f;
+    std::fill(tile_hot.begin(), tile_hot.end(), 0);
+    std::fill(tile_active.begin(), tile_active.end(), 0);
+    std::fill(tile_flatten.begin(), tile_flatten.end(), 0);
+    active_tiles.clear();
+    if (refinement != nullptr) {
+        refinement->Clear();
+    }
+    regrid_countdown = 0;
+    WaveBounds<C> calm = { 0, 0 };
+    dt = params.adaptive_dt ? CflDt(calm) : params.dt;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::CopyHeight(float* out) const {
+    for (int j = 0; j < dimension_plus; j++) {
+        for (int a = 0; a < dimension_plus; ) {
+            int b = std::min(dimension_plus, RunEnd(a));
+            const S* run = water_height_curr + Offset(a, j);
+            float* row = out + j * dimension_plus + a;
+            for (int k = 0; k < b - a; k++) {
+                row[k] = P::Load(run[k]);
+            }
+            a = b;
+        }
+    }
+}
+
+template <typename P>
+bool BasicShallowWaterSolver<P>::SetRefine(int ratio) {
+    if (ratio > 1 && (params.advection != kCentralAdvection || params.implicit_height
+                      || sparse || temporal_block > 1 || transport != nullptr)) {
+        return false;
+    }
+    std::vector<int> blocks;
+    if (refinement != nullptr) {
+        for (int p = 0; p < refinement->Patches(); p++) {
+            int bx, by;
+            refinement->PatchBlock(p, &bx, &by);
+            blocks.push_back(bx);
+            blocks.push_back(by);
+        }
+    }
+    delete refinement;
+    refinement = nullptr;
+    params.refine = ratio;
+    if (ratio > 1) {
+        // The new patches are filled from prev by the next Regrid().
+        refinement = new Refinement<P>(dimension, ratio, std::max(params.refine_block, 2), pool);
+        for (size_t k = 0; k < blocks.size(); k += 2) {
+            refinement->Refine(blocks[k], blocks[k + 1]);
+        }
+        refinement->Connect();
+    }
+    return true;
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::RefineRatio() const {
+    return refinement != nullptr ? refinement->Ratio() : 1;
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::RefinedDimension() const {
+    return RefineRatio() * dimension;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::CopyRefinedHeight(float* out) const {
+    if (refinement == nullptr) {
+        CopyHeight(out);
+        return;
+    }
+    std::vector<float> grid(dimension_plus_2);
+    CopyHeight(&grid[0]);
+    int r = refinement->Ratio();
+    int side = r * dimension + 1;
+    for (int b = 0; b < side; b++) {
+        int y0 = std::min(b / r, dimension - 1);
+        float fy = float(b - r * y0) / r;
+        for (int a = 0; a < side; a++) {
+            int x0 = std::min(a / r, dimension - 1);
+            float fx = float(a - r * x0) / r;
+            const float* corner = &grid[y0 * dimension_plus + x0];
+            float top = corner[0] + (corner[1] - corner[0]) * fx;
+            float bottom = corner[dimension_plus]
+                           + (corner[dimension_plus + 1] - corner[dimension_plus]) * fx;
+            out[b * side + a] = top + (bottom - top) * fy;
+        }
+    }
+    refinement->CopyHeight(out);
+}
+
+template <typename P>
+bool BasicShallowWaterSolver<P>::SetKernels(const std::string& name) {
+    const KernelTable<P>* found = FindKernels<P>(name);
+    if (found == nullptr) {
+        return false;
+    }
+    kernels = found;
+    SelectFixed();
+    return true;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::SelectFixed() {
+    fixed = nullptr;
+    if (!params.specialize || params.layout != kRowMajor
+            || params.advection != kCentralAdvection) {
+        return;
+    }
+    for (const FixedKernels<P>* f = kernels->fixed; f->dimension_plus != 0; f++) {
+        if (f->dimension_plus == dimension_plus && f->stride == rows.stride) {
+            fixed = f;
+            return;
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::OwnedRows(int* j0, int* j1) const {
+    *j0 = bands.front();
+    *j1 = bands.back();
+}
+
+template <typename P>
+size_t BasicShallowWaterSolver<P>::HaloBytes(int dimension) {
+    // Height, u, v and forces.
+    return 4 * kHaloRows * (size_t)(dimension + 1) * sizeof(S);
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::Threads() const {
+    return pool->Size();
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::MultigridLevels() const {
+    return multigrid != nullptr ? multigrid->Levels() : 0;
+}
+
+template <typename P>
+std::vector<WorkerStats> BasicShallowWaterSolver<P>::GetWorkerStats() const {
+    std::vector<WorkerStats> stats;
+    if (scheduler != nullptr) {
+        for (int w = 0; w < scheduler->Workers(); w++) {
+            stats.push_back(scheduler->Stats(w));
+        }
+    }
+    return stats;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::ResetWorkerStats() {
+    if (scheduler != nullptr) {
+        scheduler->ResetStats();
+    }
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::Patches() const {
+    return refinement != nullptr ? refinement->Patches() : 0;
+}
+
+template <typename P>
+long BasicShallowWaterSolver<P>::RefinedVertices() const {
+    return refinement != nullptr ? refinement->SteppedVertices() : 0;
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::Tiles() const {
+    return tiles_x * ((int)tile_rows.size() - 1);
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::ActiveTiles() const {
+    return sparse ? (int)active_tiles.size() : Tiles();
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::Step() {
+    ImpactPass();
+    int falling = numdrops;
+    SpawnDrop();
+    SwapBuffers();
+    if (transport != nullptr) {
+        ExchangeHalos();
+    }
+    if (refinement != nullptr) {
+        Regrid();
+    }
+    if (scheduler != nullptr) {
+        StepTiles(falling);
+    } else {
+        StepBands(falling);
+    }
+    if (refinement != nullptr) {
+        StepPatches();
+    }
+    time += dt;
+    PickDt();
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::PickDt() {
+    if (params.adaptive_dt) {
+        WaveBounds<C> bounds = worker_bounds[0].bounds;
+        for (size_t w = 1; w < worker_bounds.size(); w++) {
+            bounds.speed = std::max(bounds.speed, worker_bounds[w].bounds.speed);
+            bounds.height = std::max(bounds.height, worker_bounds[w].bounds.height);
+        }
+        if (transport != nullptr) {
+            double wave[] = { (double)bounds.speed, (double)bounds.height };
+            transport->MaxAll(wave, 2);
+            bounds.speed = C(wave[0]);
+            bounds.height = C(wave[1]);
+        }
+        dt = CflDt(bounds);
+    }
+}
+
+template <typename P>
+WaveBounds<typename P::Compute>* BasicShallowWaterSolver<P>::StartBounds(int worker) {
+    if (!params.adaptive_dt) {
+        return nullptr;
+    }
+    WaveBounds<C>* bounds = &worker_bounds[worker].bounds;
+    bounds->speed = 0;
+    bounds->height = 0;
+    return bounds;
+}
+
+template <typename P>
+float BasicShallowWaterSolver<P>::CflDt(const WaveBounds<C>& bounds) const {
+    // Semi-Lagrangian advection is stable at any flow speed and the
+    // implicit height update at any gravity wave speed, so those do not
+    // count.
+    double depth = params.H + std::max(0.0, (double)bounds.height);
+    double flow = params.advection == kCentralAdvection ? bounds.speed : 0;
+    double gravity_wave = params.implicit_height ? 0 : std::sqrt(params.gravity * depth);
+    double wave = flow + gravity_wave;
+    if (wave * params.max_dt <= params.cfl * dwater) {
+        return params.max_dt;
+    }
+    return (float)(params.cfl * dwater / wave);
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::StepBands(int falling) {
+    pool->Run([this, falling](int worker) {
+        int workers = pool->Size();
+        FallDrops(falling * worker / workers, falling * (worker + 1) / workers);
+        int j0 = bands[worker], j1 = bands[worker + 1];
+        WaveBounds<C>* bounds = StartBounds(worker);
+        // Where another rank's band lies beyond the first or last worker's,
+        // that worker also computes the new velocities of the row past its
+        // end, which the heights of its edge row read.
+        bool above = worker == 0 && j0 > 0;
+        bool below = worker == workers - 1 && j1 < dimension_plus;
+        BoundaryRows(j0, j1);
+        if (above) {
+            BoundaryRows(j0 - kHaloRows, j0);
+        }
+        if (below) {
+            BoundaryRows(j1, j1 + kHaloRows);
+        }
+        pool->Barrier();
+        VelocityFrame(j0, j1, 0, dimension_plus, bounds);
+        if (above) {
+            VelocityRow(j0 - 1, 0, dimension_plus, nullptr);
+        }
+        if (below) {
+            VelocityRow(j1, 0, dimension_plus, nullptr);
+        }
+        pool->Barrier();
+        FusedStrips(j0, j1, bounds);
+        if (multigrid != nullptr) {
+            // The right-hand side reads the neighbouring bands' velocities.
+            pool->Barrier();
+            ImplicitHeight(worker);
+        }
+    });
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::StepTiles(int falling) {
+    // Phase 0 mirrors the edges of each row of tiles, phase 1 computes the
+    // velocity frame of every tile and phase 2 the rest of every tile. With
+    // params.sparse, phase 0 also flattens the tiles that went quiet, and
+    // phases 1 and 2 step only the active tiles.
+    int tiles_y = (int)tile_rows.size() - 1;
+    int tiles = Tiles();
+    if (sparse) {
+        UpdateActivity();
+        tiles = (int)active_tiles.size();
+    }
+    scheduler->Reset(0, tiles_y);
+    scheduler->Reset(1, tiles);
+    scheduler->Reset(2, tiles);
+    pool->Run([this, falling](int worker) {
+        int workers = pool->Size();
+        FallDrops(falling * worker / workers, falling * (worker + 1) / workers);
+        int k, j0, j1, i0, i1;
+        WaveBounds<C>* bounds = StartBounds(worker);
+        while (scheduler->Next(0, worker, &k)) {
+            if (sparse) {
+                for (int t = k * tiles_x; t < (k + 1) * tiles_x; t++) {
+                    if (tile_flatten[t]) {
+                        FlattenTile(t);
+                    }
+                }
+            }
+            BoundaryRows(tile_rows[k], tile_rows[k + 1]);
+        }
+        pool->Barrier();
+        scheduler->Resume(worker);
+        while (scheduler->Next(1, worker, &k)) {
+            TileBounds(sparse ? active_tiles[k] : k, &j0, &j1, &i0, &i1);
+            VelocityFrame(j0, j1, i0, i1, bounds);
+        }
+        pool->Barrier();
+        scheduler->Resume(worker);
+        while (scheduler->Next(2, worker, &k)) {
+            int t = sparse ? active_tiles[k] : k;
+            TileBounds(t, &j0, &j1, &i0, &i1);
+            FusedBlock(j0, j1, i0, i1, i0 > 0 ? i0 + 1 : i0,
+                       i1 < dimension_plus ? i1 - 1 : i1, bounds);
+            if (sparse) {
+                tile_hot[t] = Stirred(j0, j1, i0, i1);
+            }
+        }
+        pool->Barrier();
+        scheduler->Resume(worker);
+        if (multigrid != nullptr) {
+            ImplicitHeight(worker);
+        }
+    });
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::ImplicitHeight(int worker) {
+    int j0 = bands[worker], j1 = bands[worker + 1];
+    if (params.layout == kRowMajor) {
+        ImplicitRhsIn(rows, j0, j1);
+    } else {
+        ImplicitRhsIn(blocks, j0, j1);
+    }
+    multigrid->Solve(params.multigrid_cycles, worker);
+    C speed = params.layout == kRowMajor ? ImplicitUpdateIn(rows, j0, j1)
+                                         : ImplicitUpdateIn(blocks, j0, j1);
+    // The kernels saw the velocities before the new heights, and the CFL
+    // step wants the ones the step ends with.
+    if (params.adaptive_dt) {
+        worker_bounds[worker].bounds.speed = speed;
+    }
+}
+
+template <typename P>
+template <typename L>
+void BasicShallowWaterSolver<P>::ImplicitRhsIn(const L& layout, int j0, int j1) {
+    // Gravity waves are stepped with the trapezoidal rule: velocities by
+    // the mean of the previous and new height gradients, heights by the
+    // mean of the previous and new velocity divergences. The kernels ran
+    // with half of gravity, so curr holds velocities u* with the previous
+    // half applied and heights h* with all of the divergence of u*. The new
+    // heights h and velocities u* - dt g / 2 grad h then satisfy
+    //
+    //     h - dt^2 g / 4 (H + h_prev) laplacian(h)
+    //         = h* + dt / 2 (H + h_prev) div(u* - u_prev)
+    //
+    // with the height on the edge of the grid held at 0, as the explicit
+    // update never changes it. h* is the first guess.
+    C dx = C(params.water_len) / dimension;
+    C step = C(dt);
+    C a = C(0.25) * step * step * C(params.gravity) / (dx * dx);
+    C half_dt = C(0.5) * step * (C(1) / (2 * dx));
+    C* x = multigrid->Solution();
+    C* b = multigrid->Rhs();
+    C* coefficient = multigrid->Coefficient();
+    const int s = multigrid->Stride();
+    for (int j = j0; j < j1; j++) {
+        for (int i = 0; i < dimension_plus; i++) {
+            int cell = layout.Index(i, j);
+            C depth = std::max(C(params.H) + P::Load(water_height_prev[cell]), C(0));
+            C h = 0;
+            if (i > 0 && i < dimension && j > 0 && j < dimension) {
+                int left = layout.Index(i - 1, j), right = layout.Index(i + 1, j);
+                int up = layout.Index(i, j - 1), down = layout.Index(i, j + 1);
+                C du = (P::Load(water_u_curr[right]) - P::Load(water_u_prev[right]))
+                       - (P::Load(water_u_curr[left]) - P::Load(water_u_prev[left]));
+                C dv = (P::Load(water_v_curr[down]) - P::Load(water_v_prev[down]))
+                       - (P::Load(water_v_curr[up]) - P::Load(water_v_prev[up]));
+                h = P::Load(water_height_curr[cell]) + half_dt * depth * (du + dv);
+            }
+            x[j * s + i] = h;
+            b[j * s + i] = h;
+            coefficient[j * s + i] = a * depth;
+        }
+    }
+}
+
+template <typename P>
+template <typename L>
+typename P::Compute BasicShallowWaterSolver<P>::ImplicitUpdateIn(const L& layout,
+                                                                int j0, int j1) {
+    // The gradient is the central difference the velocity kernels take,
+    // one-sided on the edge as if the edge heights were mirrored.
+    const C* x = multigrid->Solution();
+    const int s = multigrid->Stride();
+    C dx = C(params.water_len) / dimension;
+    C g_dt = C(0.5) * C(params.gravity) * C(dt) * (C(1) / (2 * dx));
+    C speed = 0;
+    for (int j = j0; j < j1; j++) {
+        const C* row = x + j * s;
+        const C* up = x + std::max(j - 1, 0) * s;
+        const C* down = x + std::min(j + 1, dimension) * s;
+        for (int i = 0; i < dimension_plus; i++) {
+            int cell = layout.Index(i, j);
+            if (i > 0 && i < dimension && j > 0 && j < dimension) {
+                water_height_curr[cell] = P::Store(row[i]);
+            }
+            C grad_i = row[std::min(i + 1, dimension)] - row[std::max(i - 1, 0)];
+            C grad_j = down[i] - up[i];
+            C u = P::Load(water_u_curr[cell]) - g_dt * grad_i;
+            C v = P::Load(water_v_curr[cell]) - g_dt * grad_j;
+            water_u_curr[cell] = P::Store(u);
+            water_v_curr[cell] = P::Store(v);
+            speed = std::max(speed, std::max(std::abs(u), std::abs(v)));
+        }
+    }
+    return speed;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::TileBounds(int t, int* j0, int* j1, int* i0, int* i1) const {
+    int ty = t / tiles_x, tx = t % tiles_x;
+    *j0 = tile_rows[ty];
+    *j1 = tile_rows[ty + 1];
+    *i0 = tile_cols[tx];
+    *i1 = tile_cols[tx + 1];
+}
+
+template <typename P>
+int BasicShallowWaterSolver<P>::TileOf(int i, int j) const {
+    int ty = (int)(std::upper_bound(tile_rows.begin(), tile_rows.end(), j) - tile_rows.begin()) - 1;
+    int tx = (int)(std::upper_bound(tile_cols.begin(), tile_cols.end(), i) - tile_cols.begin()) - 1;
+    return ty * tiles_x + tx;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::UpdateActivity() {
+    // The stencils and the traces of water slower than the threshold reach
+    // one cell into the neighbouring tiles, so a tile whose neighbours and
+    // itself are flat stays flat for a step. Tiles are at least two cells
+    // a side.
+    int tiles_y = (int)tile_rows.size() - 1;
+    active_tiles.clear();
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            bool active = false;
+            for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, tiles_y - 1); y++) {
+                for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, tiles_x - 1); x++) {
+                    active = active || tile_hot[y * tiles_x + x];
+                }
+            }
+            int t = ty * tiles_x + tx;
+            tile_flatten[t] = tile_active[t] && !active;
+            tile_active[t] = active;
+            if (active) {
+                active_tiles.push_back(t);
+            }
+        }
+    }
+}
+
+template <typename P>
+bool BasicShallowWaterSolver<P>::Stirred(int j0, int j1, int i0, int i1) const {
+    // Written so that NaN counts as stirred, and a blow-up is not flattened
+    // away.
+    C threshold = C(params.activity_threshold);
+    for (int j = j0; j < j1; j++) {
+        for (int a = i0; a < i1; ) {
+            int b = std::min(i1, RunEnd(a));
+            int run = Offset(a, j);
+            for (int cell = run; cell < run + b - a; cell++) {
+                if (!(std::abs(P::Load(water_height_curr[cell])) <= threshold
+                      && std::abs(P::Load(water_u_curr[cell])) <= threshold
+                      && std::abs(P::Load(water_v_curr[cell])) <= threshold)) {
+                    return true;
+                }
+            }
+            a = b;
+        }
+    }
+    return false;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::FlattenTile(int t) {
+    // The forces are 0 already: the height sweep cleared them, and a drop
+    // would have kept the tile active.
+    S* planes[] = {
+        water_height_curr, water_height_prev, water_u_curr,
+        water_u_prev, water_v_curr, water_v_prev
+    };
+    S zero = P::Store(0);
+    int j0, j1, i0, i1;
+    TileBounds(t, &j0, &j1, &i0, &i1);
+    for (int j = j0; j < j1; j++) {
+        for (int a = i0; a < i1; ) {
+            int b = std::min(i1, RunEnd(a));
+            int run = Offset(a, j);
+            for (int p = 0; p < 6; p++) {
+                std::fill(planes[p] + run, planes[p] + run + b - a, zero);
+            }
+            a = b;
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::Advance(int n) {
+    while (n > 0) {
+        if (temporal_block > 1) {
+            int steps = std::min(n, temporal_block);
+            StepBlock(steps);
+            n -= steps;
+        } else {
+            Step();
+            n--;
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::StepBlock(int steps) {
+    // The rain does not depend on the water, so it goes through the steps
+    // of the block first, in the order Step() would move it.
+    landed.clear();
+    landed_begin.clear();
+    for (int k = 0; k < steps; k++) {
+        landed_begin.push_back((int)landed.size());
+        LandDrops(&landed);
+        int falling = numdrops;
+        SpawnDrop();
+        FallDrops(0, falling);
+        time += dt;
+    }
+    landed_begin.push_back((int)landed.size());
+    impact_cells.clear();
+    impact_begin.clear();
+    for (int k = 0; k < steps; k++) {
+        BucketImpacts(landed.data() + landed_begin[k],
+                      (landed_begin[k + 1] - landed_begin[k]) / 2);
+    }
+    impact_begin.push_back((int)impact_cells.size() / 2);
+    // Tiles read the planes the last block wrote and write the others, so
+    // a tile never reads a neighbour that is already further on.
+    SwapBuffers();
+    scheduler->Reset(0, Tiles());
+    pool->Run([this, steps](int worker) {
+        WaveBounds<C>* bounds = StartBounds(worker);
+        int t;
+        while (scheduler->Next(0, worker, &t)) {
+            BlockTile(t, steps, worker, bounds);
+        }
+        pool->Barrier();
+        scheduler->Resume(worker);
+    });
+    PickDt();
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::BlockTile(int t, int steps, int worker,
+                                           WaveBounds<C>* bounds) {
+    // A velocity reads the previous step one cell out, and a height the new
+    // velocities one cell out, so each step can compute two cells less far
+    // out than the one before it. The tile is copied with a margin of two
+    // cells per step, plus the ghost cells where it meets the edge of the
+    // grid, and the last step leaves the tile itself right. Local cell (x,
+    // y) of a plane is cell (x + x0, y + y0) of the grid.
+    int j0, j1, i0, i1;
+    TileBounds(t, &j0, &j1, &i0, &i1);
+    int reach = 2 * steps;
+    int x0 = std::max(i0 - reach, -1), x1 = std::min(i1 + reach, dimension_plus + 1);
+    int y0 = std::max(j0 - reach, -1), y1 = std::min(j1 + reach, dimension_plus + 1);
+    BlockPlanes& b = block_planes[worker];
+    const int s = b.stride;
+    S* cells = &b.cells[0];
+    S* height[2] = { cells, cells + 3 * b.plane };
+    S* u[2] = { cells + b.plane, cells + 4 * b.plane };
+    S* v[2] = { cells + 2 * b.plane, cells + 5 * b.plane };
+    S* force = cells + 6 * b.plane;
+
+    // Heights go into both buffers, since the height rows never write the
+    // edge of the grid.
+    for (int j = std::max(y0, 0); j < std::min(y1, dimension_plus); j++) {
+        for (int a = std::max(x0, 0); a < std::min(x1, dimension_plus); ) {
+            int e = std::min(std::min(x1, dimension_plus), RunEnd(a));
+            int g = Offset(a, j);
+            int l = (j - y0) * s + a - x0;
+            std::copy(water_height_prev + g, water_height_prev + g + e - a, height[0] + l);
+            std::copy(water_height_prev + g, water_height_prev + g + e - a, height[1] + l);
+            std::copy(water_u_prev + g, water_u_prev + g + e - a, u[0] + l);
+            std::copy(water_v_prev + g, water_v_prev + g + e - a, v[0] + l);
+            a = e;
+        }
+    }
+    for (int y = 0; y < y1 - y0; y++) {
+        std::fill(force + y * s, force + y * s + x1 - x0, P::Store(0));
+    }
+
+    StencilConstants<C> c = Constants();
+    for (int k = 0, cur = 0; k < steps; k++, cur = 1 - cur) {
+        SplatImpacts(k, x0, x1, y0, y1, [force, s, x0, y0](int i, int j, C push) {
+            S& cell = force[(j - y0) * s + i - x0];
+            cell = P::Store(P::Load(cell) + push);
+        });
+        // What BoundaryPass() does to the grid.
+        S* mirrored[] = { height[cur], u[cur], v[cur], force };
+        for (int p = 0; p < 4; p++) {
+            S* plane = mirrored[p];
+            for (int y = std::max(y0, 0) - y0; y < std::min(y1, dimension_plus) - y0; y++) {
+                if (x0 < 0) {
+                    plane[y * s] = plane[y * s + 1];
+                }
+                if (x1 > dimension_plus) {
+                    plane[y * s + dimension_plus - x0] = plane[y * s + dimension - x0];
+                }
+            }
+            if (y0 < 0) {
+                std::copy(plane + s, plane + s + x1 - x0, plane);
+            }
+            if (y1 > dimension_plus) {
+                S* edge = plane + (dimension - y0) * s;
+                std::copy(edge, edge + x1 - x0, edge + s);
+            }
+        }
+
+        int m = 2 * (steps - 1 - k);
+        int vb = std::max(i0 - m - 1, 0) - x0, ve = std::min(i1 + m + 1, dimension_plus) - x0;
+        for (int j = std::max(j0 - m - 1, 0); j < std::min(j1 + m + 1, dimension_plus); j++) {
+            int row = (j - y0) * s;
+            VelocityRowArgs<S> r;
+            r.height      = height[cur] + row;
+            r.height_up   = height[cur] + row - s;
+            r.height_down = height[cur] + row + s;
+            r.force       = force + row;
+            r.force_up    = force + row - s;
+            r.force_down  = force + row + s;
+            r.u           = u[cur] + row;
+            r.u_up        = u[cur] + row - s;
+            r.u_down      = u[cur] + row + s;
+            r.v           = v[cur] + row;
+            r.v_up        = v[cur] + row - s;
+            r.v_down      = v[cur] + row + s;
+            r.u_out       = u[1 - cur] + row;
+            r.v_out       = v[1 - cur] + row;
+            kernels->velocity_row(r, c, vb, ve, bounds);
+        }
+        int hb = std::max(i0 - m, 1) - x0, he = std::min(i1 + m, dimension) - x0;
+        for (int j = std::max(j0 - m, 1); j < std::min(j1 + m, dimension); j++) {
+            int row = (j - y0) * s;
+            HeightRowArgs<S> r;
+            r.height      = height[cur] + row;
+            r.height_up   = height[cur] + row - s;
+            r.height_down = height[cur] + row + s;
+            r.u           = u[1 - cur] + row;
+            r.v           = v[1 - cur] + row;
+            r.v_up        = v[1 - cur] + row - s;
+            r.v_down      = v[1 - cur] + row + s;
+            r.height_out  = height[1 - cur] + row;
+            r.force       = force + row;
+            kernels->height_row(r, c, hb, he);
+        }
+    }
+
+    int last = steps % 2;
+    for (int j = j0; j < j1; j++) {
+        for (int a = i0; a < i1; ) {
+            int e = std::min(i1, RunEnd(a));
+            int g = Offset(a, j);
+            int l = (j - y0) * s + a - x0;
+            std::copy(height[last] + l, height[last] + l + e - a, water_height_curr + g);
+            std::copy(u[last] + l, u[last] + l + e - a, water_u_curr + g);
+            std::copy(v[last] + l, v[last] + l + e - a, water_v_curr + g);
+            a = e;
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::Regrid() {
+    // Blocks are refined where a drop lands, and every kRegridInterval
+    // steps where ripples are on their way. A patch goes once its ripples
+    // are below half the threshold, so a block does not flip back and
+    // forth, but not before its first ripples have had time to spread.
+    int blocks_x = refinement->BlocksX();
+    int side = std::max(params.refine_block, 2);
+    std::vector<unsigned char> struck(blocks_x * blocks_x, 0);
+    for (size_t d = 0; d < landed.size(); d += 2) {
+        int i = (int)(landed[d] / dwater), j = (int)(landed[d + 1] / dwater);
+        int bx0 = std::max(i - kImpactReach, 0) / side;
+        int bx1 = std::min(i + kImpactReach, dimension - 1) / side;
+        int by0 = std::max(j - kImpactReach, 0) / side;
+        int by1 = std::min(j + kImpactReach, dimension - 1) / side;
+        for (int by = by0; by <= by1; by++) {
+            for (int bx = bx0; bx <= bx1; bx++) {
+                struck[by * blocks_x + bx] = 1;
+            }
+        }
+    }
+    bool regrid = --regrid_countdown <= 0;
+    if (regrid) {
+        regrid_countdown = kRegridInterval;
+    }
+    // Decided on the patches as they are, then applied.
+    C threshold = params.refine_steepness;
+    std::vector<int> stirred, calm;
+    for (int by = 0; by < blocks_x; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            int p = refinement->PatchOf(bx, by);
+            if (p < 0 && (struck[by * blocks_x + bx]
+                          || (regrid && BlockSteepness(bx, by, kRegridReach) > threshold))) {
+                stirred.push_back(bx);
+                stirred.push_back(by);
+            } else if (p >= 0 && regrid && !struck[by * blocks_x + bx]
+                       && refinement->Age(p) >= kRegridInterval
+                       && BlockSteepness(bx, by, 0) < C(0.5) * threshold) {
+                calm.push_back(bx);
+                calm.push_back(by);
+            }
+        }
+    }
+    for (size_t k = 0; k < stirred.size(); k += 2) {
+        refinement->Refine(stirred[k], stirred[k + 1]);
+    }
+    for (size_t k = 0; k < calm.size(); k += 2) {
+        refinement->Coarsen(calm[k], calm[k + 1]);
+    }
+    bool changed = !stirred.empty() || !calm.empty();
+    if (changed) {
+        refinement->Connect();
+    }
+    CopyWindows(false, false);
+    refinement->Prolong();
+    float fine_dwater = params.water_len / RefinedDimension();
+    for (size_t d = 0; d < landed.size(); d += 2) {
+        refinement->Impact((int)(landed[d] / fine_dwater), (int)(landed[d + 1] / fine_dwater),
+                           params.forceconst);
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::StepPatches() {
+    // The patches' stepped vertices take the central differences of a
+    // uniform grid of RefinedDimension() cells with dt / refine.
+    CopyWindows(true, false);
+    StencilConstants<C> fine = Constants();
+    fine.dt = C(dt) / C(refinement->Ratio());
+    fine.inv_double_dwater = C(1) / (2 * (C(params.water_len) / RefinedDimension()));
+    refinement->Advance(kernels, fine);
+    CopyWindows(true, true);
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::CopyWindows(bool end, bool store) {
+    // Only the vertices inside a patch come back as averages; the ones on
+    // its edge keep what the grid's step left there.
+    S* planes[2][3] = { { water_height_prev, water_u_prev, water_v_prev },
+                        { water_height_curr, water_u_curr, water_v_curr } };
+    int inset = store ? 1 : 0;
+    for (int p = 0; p < refinement->Patches(); p++) {
+        int bx, by, i0, j0, nx, ny;
+        refinement->PatchBlock(p, &bx, &by);
+        refinement->BlockCells(bx, &i0, &nx);
+        refinement->BlockCells(by, &j0, &ny);
+        for (int f = 0; f < 3; f++) {
+            S* plane = planes[end][f];
+            C* window = refinement->Window(p, end, typename Refinement<P>::Field(f));
+            for (int l = inset; l <= ny - inset; l++) {
+                for (int a = i0 + inset; a <= i0 + nx - inset; ) {
+                    int e = std::min(i0 + nx - inset + 1, RunEnd(a));
+                    S* run = plane + Offset(a, j0 + l);
+                    C* row = window + l * (nx + 1) + a - i0;
+                    for (int k = 0; k < e - a; k++) {
+                        if (store) {
+                            run[k] = P::Store(row[k]);
+                        } else {
+                            row[k] = P::Load(run[k]);
+                        }
+                    }
+                    a = e;
+                }
+            }
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::ExchangeHalos() {
+    // The ends of the grid have no rank beyond them, and the transport
+    // skips those messages.
+    int first = bands.front(), last = bands.back();
+    size_t count = halo_send.size() / 2;
+    S* to_up = &halo_send[0];
+    S* to_down = to_up + count;
+    S* from_up = &halo_recv[0];
+    S* from_down = from_up + count;
+    if (first > 0) {
+        CopyHaloRows(first, to_up, false);
+    }
+    if (last < dimension_plus) {
+        CopyHaloRows(last - kHaloRows, to_down, false);
+    }
+    transport->Exchange(to_up, from_up, to_down, from_down, count * sizeof(S));
+    if (first > 0) {
+        CopyHaloRows(first - kHaloRows, from_up, true);
+    }
+    if (last < dimension_plus) {
+        CopyHaloRows(last, from_down, true);
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::CopyHaloRows(int j, S* buffer, bool store) {
+    S* planes[] = { water_height_prev, water_u_prev, water_v_prev, water_forces };
+    for (int f = 0; f < 4; f++) {
+        for (int l = j; l < j + kHaloRows; l++) {
+            for (int a = 0; a < dimension_plus; ) {
+                int e = std::min(dimension_plus, RunEnd(a));
+                S* run = planes[f] + Offset(a, l);
+                if (store) {
+                    std::copy(buffer, buffer + e - a, run);
+                } else {
+                    std::copy(run, run + e - a, buffer);
+                }
+                buffer += e - a;
+                a = e;
+            }
+        }
+    }
+}
+
+template <typename P>
+typename P::Compute BasicShallowWaterSolver<P>::BlockSteepness(int bx, int by,
+                                                               int reach) const {
+    // Ripples shorter than a few cells average out on the grid, so where
+    // the block or its neighbours are refined the patches measure them.
+    int i0, j0, nx, ny;
+    refinement->BlockCells(bx, &i0, &nx);
+    refinement->BlockCells(by, &j0, &ny);
+    int x0 = std::max(i0 - reach, 0), x1 = std::min(i0 + nx + reach, dimension);
+    int y0 = std::max(j0 - reach, 0), y1 = std::min(j0 + ny + reach, dimension);
+    C steepest = 0;
+    for (int j = y0; j <= y1; j++) {
+        for (int i = x0; i <= x1; i++) {
+            C h = P::Load(water_height_prev[Offset(i, j)]);
+            if (i < x1) {
+                steepest = std::max(steepest,
+                                    AbsOf(P::Load(water_height_prev[Offset(i + 1, j)]) - h));
+            }
+            if (j < y1) {
+                steepest = std::max(steepest,
+                                    AbsOf(P::Load(water_height_prev[Offset(i, j + 1)]) - h));
+            }
+        }
+    }
+    int r = refinement->Ratio();
+    int blocks_x = refinement->BlocksX();
+    for (int y = std::max(by - 1, 0); y <= std::min(by + 1, blocks_x - 1); y++) {
+        for (int x = std::max(bx - 1, 0); x <= std::min(bx + 1, blocks_x - 1); x++) {
+            int p = refinement->PatchOf(x, y);
+            if (p >= 0) {
+                steepest = std::max(steepest,
+                                    refinement->Steepness(p, r * x0, r * y0, r * x1, r * y1));
+            }
+        }
+    }
+    return steepest;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::RainPass() {
+    ImpactPass();
+    FallDrops(0, numdrops);
+    SpawnDrop();
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::ImpactPass() {
+    landed.clear();
+    LandDrops(&landed);
+    if (refinement != nullptr) {
+        // A patch takes the drop on its finer cells, and the grid gets the
+        // average of that instead of its own wider push.
+        return;
+    }
+    impact_cells.clear();
+    impact_begin.clear();
+    int drops = (int)landed.size() / 2;
+    BucketImpacts(landed.data(), drops);
+    impact_begin.push_back((int)impact_cells.size() / 2);
+    if (drops == 0) {
+        return;
+    }
+    if (sparse) {
+        int r = std::max(params.impact_radius, 0);
+        for (int d = 0; d < drops; d++) {
+            int i = impact_cells[2 * d], j = impact_cells[2 * d + 1];
+            int t0 = TileOf(std::max(i - r, 0), std::max(j - r, 0));
+            int t1 = TileOf(std::min(i + r, dimension), std::min(j + r, dimension));
+            for (int ty = t0 / tiles_x; ty <= t1 / tiles_x; ty++) {
+                for (int tx = t0 % tiles_x; tx <= t1 % tiles_x; tx++) {
+                    tile_hot[ty * tiles_x + tx] = 1;
+                }
+            }
+        }
+    }
+    // Each worker pushes the rows it steps, so no two write the same cell.
+    // Every rank lands every drop, and pushes the rows it owns.
+    if (drops >= kParallelImpacts) {
+        pool->Run([this](int worker) {
+            SplatForces(bands[worker], bands[worker + 1]);
+        });
+    } else {
+        SplatForces(bands.front(), bands.back());
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::BucketImpacts(const float* positions, int count) {
+    // A counting sort: count the drops in each bucket, turn the counts into
+    // where each bucket starts, then put each drop in its place. Drops in
+    // the same bucket keep the order they landed in.
+    int buckets = impact_buckets_x * impact_buckets_x;
+    impact_count.assign(buckets, 0);
+    for (int d = 0; d < count; d++) {
+        int i = std::min(std::max((int)(positions[2 * d] / dwater), 0), dimension);
+        int j = std::min(std::max((int)(positions[2 * d + 1] / dwater), 0), dimension);
+        impact_count[j / kImpactBucket * impact_buckets_x + i / kImpactBucket]++;
+    }
+    int start = (int)impact_cells.size() / 2;
+    for (int b = 0; b < buckets; b++) {
+        impact_begin.push_back(start);
+        int n = impact_count[b];
+        impact_count[b] = start;
+        start += n;
+    }
+    impact_cells.resize(2 * start);
+    for (int d = 0; d < count; d++) {
+        int i = std::min(std::max((int)(positions[2 * d] / dwater), 0), dimension);
+        int j = std::min(std::max((int)(positions[2 * d + 1] / dwater), 0), dimension);
+        int slot = impact_count[j / kImpactBucket * impact_buckets_x + i / kImpactBucket]++;
+        impact_cells[2 * slot] = i;
+        impact_cells[2 * slot + 1] = j;
+    }
+}
+
+template <typename P>
+template <typename F>
+void BasicShallowWaterSolver<P>::SplatImpacts(int k, int x0, int x1, int y0, int y1,
+                                              const F& add) const {
+    // Only interior cells: the height sweep clears the forces it reads, and
+    // never reaches the edge of the grid.
+    const int r = std::max(params.impact_radius, 0);
+    const int side = 2 * r + 1;
+    x0 = std::max(x0, 1);
+    x1 = std::min(x1, dimension);
+    y0 = std::max(y0, 1);
+    y1 = std::min(y1, dimension);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    int first = k * impact_buckets_x * impact_buckets_x;
+    for (int by = (y0 - r > 0 ? y0 - r : 0) / kImpactBucket;
+         by <= std::min(y1 - 1 + r, dimension) / kImpactBucket; by++) {
+        for (int bx = (x0 - r > 0 ? x0 - r : 0) / kImpactBucket;
+             bx <= std::min(x1 - 1 + r, dimension) / kImpactBucket; bx++) {
+            int b = first + by * impact_buckets_x + bx;
+            for (int d = impact_begin[b]; d < impact_begin[b + 1]; d++) {
+                int i = impact_cells[2 * d], j = impact_cells[2 * d + 1];
+                int ib = std::max(i - r, x0), ie = std::min(i + r + 1, x1);
+                for (int l = std::max(j - r, y0); l < std::min(j + r + 1, y1); l++) {
+                    const C* weights = &splat[(l - j + r) * side + r];
+                    for (int a = ib; a < ie; a++) {
+                        add(a, l, weights[a - i]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::SplatForces(int j0, int j1) {
+    SplatImpacts(0, 0, dimension_plus, j0, j1, [this](int i, int j, C push) {
+        S& cell = water_forces[Offset(i, j)];
+        cell = P::Store(P::Load(cell) + push);
+    });
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::LandDrops(std::vector<float>* positions) {
+    // Every drop falls the same way, so drops reach the water in the order
+    // they were spawned and the ones that landed are always at the head.
+    while (numdrops > 0 && rain_drops[head * 4 + 1] < params.water_height) {
+        positions->push_back(rain_drops[head * 4 + 0] - params.water_corner);
+        positions->push_back(rain_drops[head * 4 + 2] - params.water_corner);
+        numdrops--;
+        head = (head + 1) % maxdrops;
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::FallDrops(int begin, int end) {
+    float diff = dt;
+    for (int x = begin; x < end; x++) {
+        int k = (x + head) % maxdrops;
+        if (rain_drops[k * 4 + 1] >= params.water_height){
+            rain_speeds[k] += params.gravity * diff;
+            rain_drops[k * 4 + 1] -= rain_speeds[k] * diff;
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::SpawnDrop() {
+    for (int chance = 0; chance < params.rain; chance++) {
+        int rain_check = rand() % 1000;
+        if (numdrops < maxdrops && rain_check > 950){
+            float range = 3.0f;
+            float precision = 1000.0f;
+            int xpos = rand() % 1000;
+            int zpos = rand() % 1000;
+            rain_drops[tail * 4] = xpos / precision * range - 1.5f;
+            rain_drops[tail * 4 + 1] = 5.f;
+            rain_drops[tail * 4 + 2] = zpos / precision * range - 1.5f;
+            rain_drops[tail * 4 + 3] = 1.f;
+            rain_speeds[tail] = 2.f;
+            tail = (tail + 1) % maxdrops;
+            numdrops++;
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::SwapBuffers() {
+    std::swap(water_height_prev, water_height_curr);
+    std::swap(water_u_prev, water_u_curr);
+    std::swap(water_v_prev, water_v_curr);
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::BoundaryPass() {
+    BoundaryRows(0, dimension_plus);
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::BoundaryRows(int j0, int j1) {
+    MirrorEdges(water_height_prev, j0, j1);
+    MirrorEdges(water_u_prev, j0, j1);
+    MirrorEdges(water_v_prev, j0, j1);
+    MirrorEdges(water_forces, j0, j1);
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::MirrorEdges(S* plane, int j0, int j1) {
+    for (int j = j0; j < j1; j++) {
+        S first = plane[Offset(0, j)];
+        S last = plane[Offset(dimension, j)];
+        for (int g = 1; g <= halo; g++) {
+            plane[Offset(-g, j)] = first;
+            plane[Offset(dimension + g, j)] = last;
+        }
+    }
+    // The ghost rows copy whole rows, ghost columns included, so the corners
+    // are filled too.
+    for (int g = 1; g <= halo; g++) {
+        for (int i = -halo; i <= dimension + halo; i++) {
+            if (j0 == 0) {
+                plane[Offset(i, -g)] = plane[Offset(i, 0)];
+            }
+            if (j1 == dimension_plus) {
+                plane[Offset(i, dimension + g)] = plane[Offset(i, dimension)];
+            }
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::VelocityPass() {
+    for (int j = 0; j < dimension_plus; j++){
+        VelocityRow(j, 0, dimension_plus, nullptr);
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::HeightPass() {
+    for (int j = 1; j < dimension; j++){
+        HeightRow(j, 1, dimension);
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::FusedPass() {
+    VelocityFrame(0, dimension_plus, 0, dimension_plus, nullptr);
+    FusedStrips(0, dimension_plus, nullptr);
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::VelocityFrame(int j0, int j1, int i0, int i1,
+                                               WaveBounds<C>* bounds) {
+    // The frame is what the neighbouring blocks read: the first and last
+    // rows, plus the first and last columns where another block lies
+    // beside this one. Blocks are at least two cells wide, so the two
+    // columns never coincide.
+    if (j0 < j1) {
+        VelocityRow(j0, i0, i1, bounds);
+    }
+    if (j1 - 1 > j0) {
+        VelocityRow(j1 - 1, i0, i1, bounds);
+    }
+    for (int j = j0 + 1; j < j1 - 1; j++) {
+        if (i0 > 0) {
+            VelocityRow(j, i0, i0 + 1, bounds);
+        }
+        if (i1 < dimension_plus) {
+            VelocityRow(j, i1 - 1, i1, bounds);
+        }
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::FusedStrips(int j0, int j1, WaveBounds<C>* bounds) {
+    // The strips of a band run left to right on one thread, so each strip
+    // computes the first velocity column of the next one along with its
+    // own and no column frame is needed between them.
+    for (size_t s = 0; s + 1 < strips.size(); s++) {
+        int i0 = strips[s], i1 = strips[s + 1];
+        FusedBlock(j0, j1, i0, i1, s == 0 ? i0 : i0 + 1,
+                   i1 < dimension_plus ? i1 + 1 : i1, bounds);
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::FusedBlock(int j0, int j1, int i0, int i1, int v0, int v1,
+                                            WaveBounds<C>* bounds) {
+    // Height row j - 1 needs the new velocities of rows j - 2 to j, so the
+    // velocity sweep runs one row ahead of the height sweep. Both touch the
+    // same three rows of each plane while they are still in cache. The
+    // first and last rows of the block are already done, and so are the
+    // velocity columns outside [v0, v1) that the heights read.
+    if (fixed != nullptr && i0 == 0 && i1 == dimension_plus
+            && v0 == 0 && v1 == dimension_plus) {
+        fixed->fused_rows(Planes(), Constants(), j0, j1, bounds);
+        return;
+    }
+    int h0 = std::max(i0, 1);
+    int h1 = std::min(i1, dimension);
+    for (int j = j0 + 1; j < j1 - 1; j++){
+        VelocityRow(j, v0, v1, bounds);
+        if (j - 1 >= 1){
+            HeightRow(j - 1, h0, h1);
+        }
+    }
+    for (int j = std::max(j0, j1 - 2); j < j1; j++){
+        if (j >= 1 && j < dimension){
+            HeightRow(j, h0, h1);
+        }
+    }
+}
+
+template <typename P>
+StencilConstants<typename P::Compute> BasicShallowWaterSolver<P>::Constants() const {
+    // With the implicit height update, ImplicitHeight() applies the other
+    // half of gravity after the kernels.
+    StencilConstants<C> c;
+    c.dt = dt;
+    c.gravity = params.implicit_height ? 0.5f * params.gravity : params.gravity;
+    c.H = params.H;
+    c.inv_double_dwater = C(1) / (2 * (C(params.water_len) / dimension));
+    return c;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::VelocityRow(int j, int begin, int end,
+                                             WaveBounds<C>* bounds) {
+    if (params.advection != kCentralAdvection) {
+        AdvectVelocityRow(j, begin, end, bounds);
+    } else if (params.layout == kRowMajor) {
+        VelocityRowIn(rows, j, begin, end, bounds);
+    } else {
+        VelocityRowIn(blocks, j, begin, end, bounds);
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::HeightRow(int j, int begin, int end) {
+    if (params.advection != kCentralAdvection) {
+        AdvectHeightRow(j, begin, end);
+    } else if (params.layout == kRowMajor) {
+        HeightRowIn(rows, j, begin, end);
+    } else {
+        HeightRowIn(blocks, j, begin, end);
+    }
+}
+
+template <typename P>
+template <typename L>
+void BasicShallowWaterSolver<P>::VelocityRowIn(const L& layout, int j, int begin, int end,
+                                               WaveBounds<C>* bounds) {
+    StencilConstants<C> c = Constants();
+    for (int a = begin; a < end; ) {
+        int run_start = layout.RunStart(a);
+        int run_end = layout.RunEnd(a);
+        int b = std::min(end, run_end);
+        // Row pointers indexed by column, good for the columns of this run.
+        int row  = layout.Index(a, j) - a;
+        int up   = layout.Index(a, j - 1) - a;
+        int down = layout.Index(a, j + 1) - a;
+        VelocityRowArgs<S> r;
+        r.height      = water_height_prev + row;
+        r.height_up   = water_height_prev + up;
+        r.height_down = water_height_prev + down;
+        r.force       = water_forces + row;
+        r.force_up    = water_forces + up;
+        r.force_down  = water_forces + down;
+        r.u           = water_u_prev + row;
+        r.u_up        = water_u_prev + up;
+        r.u_down      = water_u_prev + down;
+        r.v           = water_v_prev + row;
+        r.v_up        = water_v_prev + up;
+        r.v_down      = water_v_prev + down;
+        r.u_out       = water_u_curr + row;
+        r.v_out       = water_v_curr + row;
+        int inner_begin = std::max(a, run_start + 1);
+        int inner_end = std::min(b, run_end - 1);
+        if (inner_begin < inner_end) {
+            kernels->velocity_row(r, c, inner_begin, inner_end, bounds);
+        }
+        for (int i = a; i < b; i++) {
+            if (i >= inner_begin && i < inner_end) {
+                // The kernel did these; go on at the far end of the run.
+                i = inner_end - 1;
+                continue;
+            }
+            // The run ends next to this cell, so its row neighbours are
+            // copied out and the kernel runs on the one cell.
+            S height[3], force[3], u[3], v[3];
+            for (int d = -1; d <= 1; d++) {
+                int cell = layout.Index(i + d, j);
+                height[d + 1] = water_height_prev[cell];
+                force[d + 1] = water_forces[cell];
+                u[d + 1] = water_u_prev[cell];
+                v[d + 1] = water_v_prev[cell];
+            }
+            VelocityRowArgs<S> g;
+            g.height      = height + 1;
+            g.height_up   = r.height_up + i;
+            g.height_down = r.height_down + i;
+            g.force       = force + 1;
+            g.force_up    = r.force_up + i;
+            g.force_down  = r.force_down + i;
+            g.u           = u + 1;
+            g.u_up        = r.u_up + i;
+            g.u_down      = r.u_down + i;
+            g.v           = v + 1;
+            g.v_up        = r.v_up + i;
+            g.v_down      = r.v_down + i;
+            g.u_out       = r.u_out + i;
+            g.v_out       = r.v_out + i;
+            VelocityCell<P>(g, c, 0, bounds);
+        }
+        a = b;
+    }
+}
+
+template <typename P>
+template <typename L>
+void BasicShallowWaterSolver<P>::HeightRowIn(const L& layout, int j, int begin, int end) {
+    StencilConstants<C> c = Constants();
+    for (int a = begin; a < end; ) {
+        int run_start = layout.RunStart(a);
+        int run_end = layout.RunEnd(a);
+        int b = std::min(end, run_end);
+        int row  = layout.Index(a, j) - a;
+        int up   = layout.Index(a, j - 1) - a;
+        int down = layout.Index(a, j + 1) - a;
+        HeightRowArgs<S> r;
+        r.height      = water_height_prev + row;
+        r.height_up   = water_height_prev + up;
+        r.height_down = water_height_prev + down;
+        r.u           = water_u_curr + row;
+        r.v           = water_v_curr + row;
+        r.v_up        = water_v_curr + up;
+        r.v_down      = water_v_curr + down;
+        r.height_out  = water_height_curr + row;
+        r.force       = water_forces + row;
+        int inner_begin = std::max(a, run_start + 1);
+        int inner_end = std::min(b, run_end - 1);
+        if (inner_begin < inner_end) {
+            kernels->height_row(r, c, inner_begin, inner_end);
+        }
+        for (int i = a; i < b; i++) {
+            if (i >= inner_begin && i < inner_end) {
+                // The kernel did these; go on at the far end of the run.
+                i = inner_end - 1;
+                continue;
+            }
+            S height[3], u[3];
+            for (int d = -1; d <= 1; d++) {
+                int cell = layout.Index(i + d, j);
+                height[d + 1] = water_height_prev[cell];
+                u[d + 1] = water_u_curr[cell];
+            }
+            HeightRowArgs<S> g;
+            g.height      = height + 1;
+            g.height_up   = r.height_up + i;
+            g.height_down = r.height_down + i;
+            g.u           = u + 1;
+            g.v           = r.v + i;
+            g.v_up        = r.v_up + i;
+            g.v_down      = r.v_down + i;
+            g.height_out  = r.height_out + i;
+            g.force       = r.force + i;
+            HeightCell<P>(g, c, 0);
+        }
+        a = b;
+    }
+}
+
+template <typename P>
+FusedPlanes<typename P::Storage> BasicShallowWaterSolver<P>::Planes() const {
+    FusedPlanes<S> planes = {
+        water_height_prev, water_u_prev, water_v_prev, water_forces,
+        water_height_curr, water_u_curr, water_v_curr
+    };
+    return planes;
+}
+
+template <typename P>
+TraceConstants<typename P::Compute> BasicShallowWaterSolver<P>::Tracing() const {
+    TraceConstants<C> t;
+    t.cells_per_speed = C(dt) / C(dwater);
+    t.dimension = dimension;
+    t.stride = rows.stride;
+    t.maccormack = params.advection == kMacCormack;
+    return t;
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::AdvectVelocityRow(int j, int begin, int end,
+                                                   WaveBounds<C>* bounds) {
+    FusedPlanes<S> planes = Planes();
+    if (params.layout == kRowMajor) {
+        kernels->advect_velocity_row(planes, Constants(), Tracing(), j, begin, end, bounds);
+        return;
+    }
+    StencilConstants<C> c = Constants();
+    Trace<P, BlockLayout> trace(planes, blocks, Tracing());
+    for (int i = begin; i < end; i++) {
+        AdvectVelocityCell<P>(trace, c, i, j, bounds);
+    }
+}
+
+template <typename P>
+void BasicShallowWaterSolver<P>::AdvectHeightRow(int j, int begin, int end) {
+    FusedPlanes<S> planes = Planes();
+    if (params.layout == kRowMajor) {
+        kernels->advect_height_row(planes, Constants(), Tracing(), j, begin, end);
+        return;
+    }
+    StencilConstants<C> c = Constants();
+    Trace<P, BlockLayout> trace(planes, blocks, Tracing());
+    for (int i = begin; i < end; i++) {
+        AdvectHeightCell<P>(trace, c, i, j);
+    }
+}
+
+template class BasicShallowWaterSolver<FloatPrecision>;
+template class BasicShallowWaterSolver<DoublePrecision>;
+template class BasicShallowWaterSolver<HalfPrecision>;
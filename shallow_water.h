@@ -0,0 +1,466 @@
+#ifndef SHALLOW_WATER_H
+#define SHALLOW_WATER_H
+
+// Shallow water solver for the rain pool. Owns the height, velocity and force
+// planes plus the rain particles, and has no dependency on OpenGL so it can
+// run on machines without a display.
+
+#include <string>
+#include <vector>
+
+#include "advection.h"
+#include "grid_layout.h"
+#include "multigrid.h"
+#include "refinement.h"
+#include "swe_kernels.h"
+#include "tile_scheduler.h"
+
+class HaloTransport;
+class ThreadPool;
+
+// Physical constants, pool geometry and how to run the solver. The physical
+// defaults are the values main() used when the solver lived inline in
+// assignment.cc.
+struct SolverParams {
+    float dt = 0.003333f / 2.0f;
+    // Picks each step's dt from the CFL condition instead: the fastest wave
+    // the last step left behind, |u| + sqrt(gravity * (H + h)), crosses cfl
+    // grid cells per step, and no step is longer than max_dt. The explicit
+    // update slowly gains energy at any dt; 0.4 matches the fixed dt at
+    // dimension 200, and a smaller cfl slows the growth down.
+    bool adaptive_dt = false;
+    float cfl = 0.4f;
+    float max_dt = 0.01f;
+    // Solves for the new heights implicitly, with multigrid_cycles V-cycles
+    // of multigrid (see multigrid.h) per step, so gravity waves no longer
+    // limit dt and adaptive_dt only counts the flow. Gravity waves are
+    // stepped with the trapezoidal rule, which keeps the energy of the
+    // waves the grid resolves and damps the ones it does not. One cycle
+    // leaves enough error to grow over long steps (dt 0.02 at dimension
+    // 200); three agree with a converged solve up to dt 0.08.
+    bool implicit_height = false;
+    int multigrid_cycles = 3;
+    // How velocity and height move with the flow. Semi-Lagrangian
+    // advection stays stable up to a cfl of about 1.0, MacCormack up to
+    // about 0.5. Neither uses the fixed-size kernels, and the blocked
+    // layouts run both on scalar cells.
+    Advection advection = kCentralAdvection;
+    float gravity = 10.0f;
+    float forceconst = 2.0f;
+    float H = 1.7f;
+    float water_corner = -1.8f;
+    float water_len = 3.6f;
+    float water_height = -0.3f;
+    // Chances each step for a drop to start falling, each taken one time in
+    // twenty while fewer than maxdrops are in the air. Every drop takes as
+    // long to fall, so about rain / 20 land each step.
+    int rain = 1;
+    // A drop pushes the cells within impact_radius cells of where it lands,
+    // with forceconst times a Gaussian of the distance that falls to e^-2
+    // of it at impact_radius, and the pushes of drops that land close
+    // together add up. 0 pushes only the cell it lands in. Refined patches
+    // take the push on that one cell.
+    int impact_radius = 0;
+    // Ghost cells around each plane. The boundary pass fills them so the
+    // stencil kernels never branch on the edge of the grid.
+    int halo = 1;
+    // Memory layout of the planes.
+    GridLayout layout = kRowMajor;
+    // Sweeps whole rows with the kernels compiled for this grid size, when
+    // the build has them (FixedDimensions) and the layout is rows.
+    bool specialize = true;
+    // Worker threads for Step(), the calling thread included.
+    int threads = 1;
+    // Pins the workers to NUMA nodes, consecutive row bands on the same
+    // node. Worker 0 is the thread that constructs the solver, so it is
+    // pinned too.
+    bool bind_numa = false;
+    // Side in cells of the square tiles Step() schedules with work
+    // stealing. 0 gives each worker one fixed band of whole rows instead.
+    int tile = 0;
+    // Steps only the tiles where the water moves. A tile is stepped while
+    // the largest |h|, |u| or |v| in it or one of its eight neighbours is
+    // above activity_threshold, or a drop lands in it, and is flattened to
+    // exactly 0 when it stops. A threshold of 0 only skips water that is
+    // exactly flat and gives the same results as stepping every tile; a
+    // larger one also skips the faint ripples the stencils spread ahead of
+    // a wave. Uses tiles of side tile, or 64 if tile is 0. Does nothing
+    // with implicit_height, whose solve couples every cell.
+    bool sparse = false;
+    float activity_threshold = 0.0f;
+    // Advance() takes each tile temporal_block steps at a time. A tile is
+    // copied with a margin of two cells per step, which the stencils eat
+    // into a step at a time, so it stays in cache for all the steps instead
+    // of every step sweeping the whole grid through memory. The margins are
+    // computed more than once: about 13% more work with tiles of 256 and 8
+    // steps. Uses tiles of side tile, or 256 if tile is 0. With adaptive_dt
+    // dt is picked once per block. Only with central advection and explicit
+    // heights, and not with sparse.
+    int temporal_block = 1;
+    // Refines blocks of refine_block cells refine times in space and time
+    // (see refinement.h): around each drop that lands, and wherever the
+    // height changes by more than refine_steepness per cell. A block is
+    // coarsened again once its ripples are below half of that. 0 or 1
+    // keeps the grid uniform. Only with central advection and explicit
+    // heights, and not with sparse or temporal_block. SetRefine() changes
+    // it while the solver runs.
+    int refine = 0;
+    int refine_block = 16;
+    float refine_steepness = 0.002f;
+    // Splits the rows among the ranks of transport (see halo_transport.h),
+    // each a process that steps one band of them. Before every step the
+    // neighbouring bands trade their two edge rows of the previous state
+    // and the forces, and each rank computes the new velocities of the
+    // first row past each end of its band as well as its own. A rank only
+    // touches its band and those two rows on each side, so the rest of its
+    // planes are never backed by memory. Every rank must draw the same
+    // rain, which rand() does unseeded. Only with central advection,
+    // explicit heights and bands of rows (tile 0), not with sparse or
+    // temporal_block, and with at least two rows per rank; otherwise each
+    // rank steps the whole grid. Rules refinement out. The solver does not
+    // own the transport.
+    HaloTransport* transport = nullptr;
+};
+
+// P is the precision of the planes, one of the types in swe_precision.h.
+// Rain drops and CopyHeight() are float in every precision.
+template <typename P>
+class BasicShallowWaterSolver {
+    public:
+        typedef typename P::Storage S;
+        typedef typename P::Compute C;
+    private:
+        SolverParams params;
+        int dimension;
+        int dimension_plus;
+        int dimension_plus_2;
+        int halo;
+        int plane_size;    // cells per plane allocation
+        int plane_origin;  // offset of the plane pointer from the allocation
+        int plane_rows;    // rows of the allocation, ghost rows and padding included
+        // params.layout picks which of these maps cells to memory.
+        RowLayout rows;
+        BlockLayout blocks;
+        std::vector<int> block_offsets;
+        int maxdrops;
+        float dwater;
+        float time;
+        float dt;  // the time step the next Step() takes
+        // What each worker's velocity rows saw this step, padded to a cache
+        // line each. Only gathered with params.adaptive_dt.
+        struct WorkerBounds {
+            WaveBounds<C> bounds;
+            char padding[64 - sizeof(WaveBounds<C>)];
+        };
+        std::vector<WorkerBounds> worker_bounds;
+        const KernelTable<P>* kernels;
+        const FixedKernels<P>* fixed;  // nullptr if there are none for this grid
+        ThreadPool* pool;
+        int bound_nodes;
+        std::vector<int> bands;  // worker w owns rows [bands[w], bands[w + 1])
+        std::vector<int> strips; // bands are swept in columns [strips[s], strips[s + 1])
+        // Tile t covers rows [tile_rows[t / tiles_x], tile_rows[t / tiles_x + 1])
+        // and columns [tile_cols[t % tiles_x], tile_cols[t % tiles_x + 1]).
+        TileScheduler* scheduler;  // nullptr when params.tile is 0
+        Multigrid<C>* multigrid;   // nullptr unless params.implicit_height
+        std::vector<int> tile_rows;
+        std::vector<int> tile_cols;
+        int tiles_x;
+        // With params.sparse, per tile: whether the last step or a drop left
+        // it above the threshold, whether Step() steps it, and whether it
+        // stopped being stepped and is flattened before the next sweep.
+        bool sparse;
+        std::vector<unsigned char> tile_hot;
+        std::vector<unsigned char> tile_active;
+        std::vector<unsigned char> tile_flatten;
+        std::vector<int> active_tiles;  // the tiles Step() steps, in order
+        // Steps Advance() takes each tile through at a time, 1 if it takes
+        // the whole grid through one step at a time. Each worker copies its
+        // tile into planes, seven planes of plane cells with rows stride
+        // apart: height, u and v, again for the step after, and the forces.
+        int temporal_block;
+        struct BlockPlanes {
+            std::vector<S> cells;
+            int stride;
+            int plane;
+        };
+        std::vector<BlockPlanes> block_planes;
+        // Where drops landed, measured from the corner of the pool, as x, z
+        // pairs: this step's, or step k's of a block in [landed_begin[k],
+        // landed_begin[k + 1]).
+        std::vector<float> landed;
+        std::vector<int> landed_begin;
+        // The cells those drops landed in, (i, j) pairs sorted into buckets
+        // of kImpactBucket cells a side, row by row. Bucket b of step k
+        // holds pairs [impact_begin[k * buckets + b], impact_begin[k *
+        // buckets + b + 1]), for buckets impact_buckets_x squared.
+        // impact_count is the counting sort's.
+        std::vector<int> impact_cells;
+        std::vector<int> impact_begin;
+        std::vector<int> impact_count;
+        int impact_buckets_x;
+        // The push of a drop on the cells around it: (2 params.impact_radius
+        // + 1)^2 forces, row-major, centred on the cell it lands in.
+        std::vector<C> splat;
+        // nullptr unless params.refine. Blocks are regridded every few
+        // steps, when regrid_countdown runs out.
+        Refinement<P>* refinement;
+        int regrid_countdown;
+        // params.transport, or nullptr if the other params rule it out. The
+        // halo rows go out of halo_send, up then down, and come back into
+        // halo_recv.
+        HaloTransport* transport;
+        std::vector<S> halo_send;
+        std::vector<S> halo_recv;
+
+        // One plane per field with halo ghost cells on each side. Cell
+        // (i, j) is at [Offset(i, j)] for i and j in [-halo, dimension +
+        // halo]. Cell (0, 0) and the start of every run of cells in the
+        // interior are 64-byte aligned.
+        S * water_height_curr;
+        S * water_height_prev;
+        S * water_u_curr;
+        S * water_u_prev;
+        S * water_v_curr;
+        S * water_v_prev;
+        S * water_forces;
+
+        float * rain_drops;         // size: maxdrops * 4
+        float * rain_speeds;        // size: maxdrops
+        int numdrops, head, tail;
+
+        // Planes are allocated untouched and first written by Init(), where
+        // each worker fills the rows it steps so the pages land on its NUMA
+        // node.
+        S* AllocPlane();
+        void FreePlane(S* plane);
+        // Fills allocation rows [r0, r1) of plane, counting the top ghost
+        // rows, so row j of the grid is allocation row j + halo.
+        void FillRows(S* plane, int r0, int r1, C value);
+        // Offset of cell (i, j) in any plane, and the end of the run of
+        // contiguous cells of its row that holds it.
+        int Offset(int i, int j) const;
+        int RunEnd(int i) const;
+        // Splits the columns or rows into pieces that start where the cell
+        // index plus shift is a multiple of side.
+        std::vector<int> BlockEdges(int shift, int side) const;
+        // Copies the edge cells of rows [j0, j1) of plane into their ghost
+        // cells, and fills the ghost rows if the range includes an edge row.
+        void MirrorEdges(S* plane, int j0, int j1);
+
+        // Drops that reached the water apply their force and are removed.
+        void ImpactPass();
+        // Sorts the cells that count drops landed in, at positions, into the
+        // buckets of the next step of impact_cells.
+        void BucketImpacts(const float* positions, int count);
+        // Calls add(i, j, force) for the pushes of the drops of step k on
+        // the cells of [x0, x1) x [y0, y1) that the height sweep steps, a
+        // bucket at a time, so the pushes on each cell add up in the same
+        // order whatever the rectangle.
+        template <typename F>
+        void SplatImpacts(int k, int x0, int x1, int y0, int y1, const F& add) const;
+        // Adds the pushes of this step's drops on rows [j0, j1) to the
+        // forces.
+        void SplatForces(int j0, int j1);
+        // Removes the drops that reached the water and appends where they
+        // landed to positions.
+        void LandDrops(std::vector<float>* positions);
+        // Moves drops [begin, end) of the live drops, oldest first.
+        void FallDrops(int begin, int end);
+        // Sometimes adds a drop at the top of the pool.
+        void SpawnDrop();
+
+        // The pieces of BoundaryPass() and FusedPass() for the block of rows
+        // [j0, j1) and columns [i0, i1) one worker owns. FusedBlock() needs
+        // the velocity frame of its own block and of the neighbouring blocks
+        // done first, and computes the interior velocities in columns
+        // [v0, v1). FusedStrips() runs it on each strip of a row band.
+        // The velocity rows raise bounds if it is not nullptr.
+        void BoundaryRows(int j0, int j1);
+        void VelocityFrame(int j0, int j1, int i0, int i1, WaveBounds<C>* bounds);
+        void FusedBlock(int j0, int j1, int i0, int i1, int v0, int v1,
+                        WaveBounds<C>* bounds);
+        void FusedStrips(int j0, int j1, WaveBounds<C>* bounds);
+
+        // Step() on one fixed row band per worker, or on tiles.
+        void StepBands(int falling);
+        void StepTiles(int falling);
+        // Advances every tile steps steps, which is at most temporal_block.
+        void StepBlock(int steps);
+        // One tile of StepBlock(), on worker's planes.
+        void BlockTile(int t, int steps, int worker, WaveBounds<C>* bounds);
+        // Sets dt from the bounds the workers gathered.
+        void PickDt();
+        void TileBounds(int t, int* j0, int* j1, int* i0, int* i1) const;
+        // The tile that holds cell (i, j).
+        int TileOf(int i, int j) const;
+        // Works out which tiles the next sweep steps from tile_hot.
+        void UpdateActivity();
+        // Whether the step left |h|, |u| or |v| above the threshold in a
+        // block of cells.
+        bool Stirred(int j0, int j1, int i0, int i1) const;
+        // Zeroes the heights and velocities of tile t in both buffers.
+        void FlattenTile(int t);
+        // The bounds worker gathers this step into, cleared, or nullptr if
+        // the step does not need them.
+        WaveBounds<C>* StartBounds(int worker);
+        // The CFL time step for waves within bounds.
+        float CflDt(const WaveBounds<C>& bounds) const;
+        // With params.implicit_height, the last phase of Step() on every
+        // worker: solves for the heights the fused sweep left in curr and
+        // applies their gradient to the velocities of the worker's band.
+        void ImplicitHeight(int worker);
+        // Its two halves for rows [j0, j1) of one layout: the right-hand
+        // side and first guess into multigrid, and the solution back into
+        // the planes, returning the fastest velocity it wrote.
+        template <typename L>
+        void ImplicitRhsIn(const L& layout, int j0, int j1);
+        template <typename L>
+        C ImplicitUpdateIn(const L& layout, int j0, int j1);
+
+        // With params.refine, before and after Step() sweeps the grid:
+        // refines and coarsens blocks and hands the patches the state the
+        // step starts from and the drops, then steps the patches and takes
+        // back what they averaged onto the grid.
+        void Regrid();
+        void StepPatches();
+        // The largest height difference per cell between neighbouring
+        // vertices within reach cells of block (bx, by), on prev and on the
+        // patches there.
+        C BlockSteepness(int bx, int by, int reach) const;
+        // Copies prev, or curr if end, into the patches' windows, or with
+        // store the averages in the end of the windows back into curr.
+        void CopyWindows(bool end, bool store);
+
+        // With a transport, after SwapBuffers(): sends the edge rows of the
+        // band to the neighbouring ranks and takes theirs into the rows past
+        // its ends.
+        void ExchangeHalos();
+        // Copies rows [j, j + 2) of prev and the forces into buffer, or with
+        // store back out of it.
+        void CopyHaloRows(int j, S* buffer, bool store);
+
+        // Picks the entry of kernels->fixed for this grid, if any.
+        void SelectFixed();
+
+        StencilConstants<C> Constants() const;
+        // New velocities for columns [begin, end) of row j.
+        void VelocityRow(int j, int begin, int end, WaveBounds<C>* bounds);
+        // New heights for columns [begin, end) of row j, which must lie in
+        // the interior. Reads the new velocities of rows j - 1 to j + 1.
+        void HeightRow(int j, int begin, int end);
+        // The same for one layout. Each run of contiguous cells goes to the
+        // row kernels; a cell at the end of a run has its horizontal
+        // neighbours gathered first.
+        template <typename L>
+        void VelocityRowIn(const L& layout, int j, int begin, int end,
+                           WaveBounds<C>* bounds);
+        template <typename L>
+        void HeightRowIn(const L& layout, int j, int begin, int end);
+        // VelocityRow() and HeightRow() with semi-Lagrangian advection, on
+        // the advect kernels for rows and on scalar cells for blocks.
+        void AdvectVelocityRow(int j, int begin, int end, WaveBounds<C>* bounds);
+        void AdvectHeightRow(int j, int begin, int end);
+        FusedPlanes<S> Planes() const;
+        TraceConstants<C> Tracing() const;
+
+        BasicShallowWaterSolver(const BasicShallowWaterSolver&);
+        BasicShallowWaterSolver& operator=(const BasicShallowWaterSolver&);
+    public:
+        BasicShallowWaterSolver(int dimension, int maxdrops,
+                                const SolverParams& params = SolverParams());
+        ~BasicShallowWaterSolver();
+
+        // Selects the row kernels by name (see FindKernels()). Returns false
+        // and keeps the current kernels if this CPU cannot run them. The
+        // widest supported kernels are selected on construction.
+        bool SetKernels(const std::string& name);
+        const char* KernelName() const { return kernels->name; }
+        // Refines ratio times from the next Step() on, or keeps the grid
+        // uniform for 0 or 1 (see SolverParams::refine). The blocks refined
+        // now are refined again at the new ratio, starting from the grid.
+        // Returns false and changes nothing if the solver's other params
+        // rule refinement out.
+        bool SetRefine(int ratio);
+        // 1 while the grid is uniform.
+        int RefineRatio() const;
+        // The rows [*j0, *j1) this rank steps: all of them without a
+        // transport.
+        void OwnedRows(int* j0, int* j1) const;
+        // Bytes of each message a transport carries for this precision.
+        static size_t HaloBytes(int dimension);
+        // Whether Step() runs kernels compiled for this grid size.
+        bool Specialized() const { return fixed != nullptr; }
+        int Threads() const;
+        // NUMA nodes the workers are bound to, 0 if they are not bound.
+        int BoundNodes() const { return bound_nodes; }
+        // Levels of the implicit height solve, 0 if heights are explicit.
+        int MultigridLevels() const;
+        // Tile counters per worker, one entry per thread, since construction
+        // or the last ResetWorkerStats(). Empty when params.tile is 0.
+        std::vector<WorkerStats> GetWorkerStats() const;
+        void ResetWorkerStats();
+        // Patches of the refinement, and the fine vertices they step.
+        int Patches() const;
+        long RefinedVertices() const;
+        // Tiles of the grid, 0 when Step() steps bands of rows, and how many
+        // of them the last Step() stepped.
+        int Tiles() const;
+        int ActiveTiles() const;
+
+        // Flattens the water and removes all rain.
+        void Init();
+        // Advances rain, velocities and heights by one time step.
+        void Step();
+        // Advances n time steps, temporal_block at a time when the
+        // parameters allow temporal blocking, and one Step() at a time
+        // otherwise.
+        void Advance(int n);
+        // How many steps Advance() takes each tile through at a time.
+        int TemporalBlock() const { return temporal_block; }
+
+        // The individual passes of Step(), in the order Step() runs them,
+        // each on the calling thread alone. The implicit height solve and
+        // the refinement have no pass of their own.
+        void RainPass();
+        // Makes the state Step() last wrote the prev buffers, which the
+        // next velocity and height passes read while filling curr.
+        void SwapBuffers();
+        // Fills the ghost cells of the prev planes with their edge values,
+        // which makes the central differences on the edge one-sided.
+        void BoundaryPass();
+        // Velocity and height update in one sweep of the grid.
+        void FusedPass();
+
+        // The two halves of FusedPass() as separate whole-grid sweeps.
+        void VelocityPass();
+        void HeightPass();
+
+        // Copies the heights of the (dimension + 1)^2 grid vertices into
+        // out, dimension_plus_2 floats, row-major with no gaps between rows.
+        // With a transport, only the rows this rank owns are right.
+        void CopyHeight(float* out) const;
+        // Cells a side of the finest grid the refinement steps, dimension
+        // without it, and the heights on its vertices: the patches' where
+        // they step them and the grid's interpolated between its vertices
+        // elsewhere, (RefinedDimension() + 1)^2 floats, row-major.
+        int RefinedDimension() const;
+        void CopyRefinedHeight(float* out) const;
+        // Rain drop positions as vec4s, maxdrops of them.
+        const float* RainDrops() const { return rain_drops; }
+        int NumDrops() const { return numdrops; }
+
+        int Dimension() const { return dimension; }
+        int DimensionPlus() const { return dimension_plus; }
+        int MaxDrops() const { return maxdrops; }
+        float Time() const { return time; }
+        // The time step the next Step() takes.
+        float StepDt() const { return dt; }
+        const SolverParams& Params() const { return params; }
+        GridLayout Layout() const { return params.layout; }
+};
+
+// The interactive solver.
+typedef BasicShallowWaterSolver<FloatPrecision> ShallowWaterSolver;
+
+#endif
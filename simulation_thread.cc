@@ -0,0 +1,68 @@
+#include "simulation_thread.h"
+
+#include <algorithm>
+#include <chrono>
+
+SimulationThread::SimulationThread(ShallowWaterSolver& solver, int max_substeps) :
+        solver(solver),
+        clock(max_substeps),
+        frames(Capture(solver)),
+        stopping(false),
+        refine(-1) {
+    thread = std::thread(&SimulationThread::Loop, this);
+}
+
+SimulationThread::~SimulationThread() {
+    Stop();
+}
+
+void SimulationThread::Stop() {
+    stopping = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+SimulationFrame SimulationThread::Capture(const ShallowWaterSolver& solver) {
+    SimulationFrame frame;
+    frame.dimension = solver.RefinedDimension();
+    frame.heights.resize((frame.dimension + 1) * (frame.dimension + 1));
+    solver.CopyRefinedHeight(&frame.heights[0]);
+    frame.rain_drops.assign(solver.RainDrops(), solver.RainDrops() + solver.MaxDrops() * 4);
+    frame.numdrops = solver.NumDrops();
+    frame.time = solver.Time();
+    return frame;
+}
+
+void SimulationThread::Loop() {
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    while (!stopping) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        clock.Add(std::chrono::duration<double>(now - last).count());
+        last = now;
+        int ratio = refine.exchange(-1);
+        if (ratio >= 0) {
+            solver.SetRefine(ratio);
+        }
+        int steps = 0;
+        while (clock.Take(solver.StepDt())) {
+            solver.Step();
+            steps++;
+        }
+        if (steps == 0) {
+            // Ahead of the wall clock: sleep until the next step is due.
+            std::this_thread::sleep_for(std::chrono::duration<double>(
+                    solver.StepDt() - clock.Pending()));
+            continue;
+        }
+        SimulationFrame& frame = frames.Back();
+        frame.dimension = solver.RefinedDimension();
+        frame.heights.resize((frame.dimension + 1) * (frame.dimension + 1));
+        solver.CopyRefinedHeight(&frame.heights[0]);
+        std::copy(solver.RainDrops(), solver.RainDrops() + solver.MaxDrops() * 4,
+                  frame.rain_drops.begin());
+        frame.numdrops = solver.NumDrops();
+        frame.time = solver.Time();
+        frames.Publish();
+    }
+}
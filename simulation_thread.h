@@ -0,0 +1,59 @@
+#ifndef SIMULATION_THREAD_H
+#define SIMULATION_THREAD_H
+
+// Runs a solver on a thread of its own in real time and publishes what
+// each batch of steps left behind through a triple buffer, so the renderer
+// never waits for the solver and the solver never waits for the display.
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "shallow_water.h"
+#include "step_clock.h"
+#include "triple_buffer.h"
+
+// The state after one batch of steps.
+struct SimulationFrame {
+    int dimension;                  // cells a side of heights
+    std::vector<float> heights;     // as CopyRefinedHeight() writes them
+    std::vector<float> rain_drops;  // maxdrops vec4s, as RainDrops() holds them
+    int numdrops;
+    float time;                     // solver time after the batch
+};
+
+class SimulationThread {
+    private:
+        ShallowWaterSolver& solver;
+        StepClock clock;
+        TripleBuffer<SimulationFrame> frames;
+        std::atomic<bool> stopping;
+        std::atomic<int> refine;  // the ratio asked for, -1 if none
+        std::thread thread;
+
+        void Loop();
+        static SimulationFrame Capture(const ShallowWaterSolver& solver);
+
+        SimulationThread(const SimulationThread&);
+        SimulationThread& operator=(const SimulationThread&);
+    public:
+        // Starts stepping solver, which nothing else may touch until Stop(),
+        // taking up to max_substeps steps at a time to catch up with the
+        // wall clock (see StepClock).
+        SimulationThread(ShallowWaterSolver& solver, int max_substeps);
+        ~SimulationThread();
+
+        // Finishes the current batch and joins the thread.
+        void Stop();
+        // Has the solver refine ratio times from the next batch on (see
+        // SetRefine()). The frames change size when it does.
+        void SetRefine(int ratio) { refine = ratio; }
+
+        // Makes the newest published frame Latest(). Returns false if
+        // nothing new was published since the last call.
+        bool Update() { return frames.Acquire(); }
+        // Stays valid and unchanged until the next Update().
+        const SimulationFrame& Latest() const { return frames.Front(); }
+};
+
+#endif
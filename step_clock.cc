@@ -0,0 +1,29 @@
+#include "step_clock.h"
+
+#include <cmath>
+
+StepClock::StepClock(int max_steps) :
+        max_steps(max_steps < 1 ? 1 : max_steps),
+        taken(0),
+        pending(0.0) {
+}
+
+void StepClock::Add(double seconds) {
+    if (seconds > 0.0) {
+        pending += seconds;
+    }
+    taken = 0;
+}
+
+bool StepClock::Take(double dt) {
+    if (pending < dt) {
+        return false;
+    }
+    if (taken == max_steps) {
+        pending = std::fmod(pending, dt);
+        return false;
+    }
+    pending -= dt;
+    taken++;
+    return true;
+}
@@ -0,0 +1,32 @@
+#ifndef STEP_CLOCK_H
+#define STEP_CLOCK_H
+
+// Keeps a simulation in time with the wall clock. Each frame the caller adds
+// the wall time that has passed, then takes steps while Take() says the
+// next one is due. Steps may differ in length from one to the next.
+
+class StepClock {
+    private:
+        int max_steps;
+        int taken;       // steps since the last Add()
+        double pending;  // wall time not yet covered by a step
+
+    public:
+        // At most max_steps steps per Add().
+        explicit StepClock(int max_steps);
+
+        // Adds seconds of wall time to catch up on.
+        void Add(double seconds);
+        // Whether a step of dt seconds is due, in which case it counts as
+        // taken. Once max_steps steps were taken since Add(), whole steps'
+        // worth of time left over are dropped, so a machine that cannot keep
+        // up runs slower than real time instead of falling further behind
+        // every frame.
+        bool Take(double dt);
+        // Wall time not yet covered by a step.
+        double Pending() const { return pending; }
+
+        int MaxSteps() const { return max_steps; }
+};
+
+#endif
@@ -0,0 +1,187 @@
+// Microbenchmark for the solver's velocity, height and fused passes.
+//
+// Usage: swe_bench [--min dimension] [--max dimension] [--reps N] [--kernel name]
+//                  [--layout rows|blocked|morton] [--precision float|double|half]
+//                  [--advection central|semi-lagrangian|maccormack] [--generic]
+//
+// Each pass is timed on its own over a sweep of power-of-two dimensions and
+// reported as ns/cell and effective GB/s, with the spread over the repeats.
+// Every kernel the CPU supports is timed unless --kernel picks one. The
+// fused pass uses the fixed-size kernels for the dimensions that have them
+// unless --generic is given.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "shallow_water.h"
+
+// Planes each pass moves per cell, counting every plane it reads or writes
+// once. Velocity: reads h, force and (u, v) prev, writes (u, v) curr.
+// Height: reads (u, v) curr and h prev, writes h curr and clears the force.
+const double kVelocityPlanes = 6;
+const double kHeightPlanes = 5;
+// Fused: the velocity planes written are read back from cache, and the
+// force plane is read and cleared in the same sweep.
+const double kFusedPlanes = 8;
+
+struct Stats {
+    double mean;
+    double stddev;
+    double best;
+};
+
+Stats Summarize(const std::vector<double>& samples) {
+    Stats s;
+    s.mean = 0.0;
+    s.best = samples[0];
+    for (size_t i = 0; i < samples.size(); i++) {
+        s.mean += samples[i];
+        if (samples[i] < s.best) s.best = samples[i];
+    }
+    s.mean /= samples.size();
+    double var = 0.0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        var += (samples[i] - s.mean) * (samples[i] - s.mean);
+    }
+    s.stddev = samples.size() > 1 ? std::sqrt(var / (samples.size() - 1)) : 0.0;
+    return s;
+}
+
+// Times reps calls of pass and returns seconds per call.
+template <typename Pass>
+std::vector<double> Time(Pass pass, int reps) {
+    std::vector<double> samples;
+    pass();  // warm up caches and page in the planes
+    for (int r = 0; r < reps; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        pass();
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration<double>(end - start).count());
+    }
+    return samples;
+}
+
+void Report(int dimension, const char* kernel, const char* name,
+            const std::vector<double>& samples, double cells,
+            double bytes_per_cell) {
+    Stats s = Summarize(samples);
+    std::printf("%9d  %-6s  %-8s  %10.3f  %9.3f  %10.3f  %8.2f\n", dimension, kernel, name,
+                s.mean / cells * 1e9, s.stddev / cells * 1e9,
+                s.best / cells * 1e9, cells * bytes_per_cell / s.mean * 1e-9);
+}
+
+template <typename Solver>
+struct VelocityPass {
+    Solver* solver;
+    void operator()() { solver->VelocityPass(); }
+};
+
+template <typename Solver>
+struct HeightPass {
+    Solver* solver;
+    void operator()() { solver->HeightPass(); }
+};
+
+template <typename Solver>
+struct FusedPass {
+    Solver* solver;
+    void operator()() { solver->FusedPass(); }
+};
+
+// Times every pass with every kernel (or only the one named kernel) for each
+// dimension in the sweep. Returns false if the named kernel cannot run.
+template <typename P>
+bool Sweep(const SolverParams& params, int min_dimension, int max_dimension,
+           int reps, const char* kernel_name) {
+    typedef BasicShallowWaterSolver<P> Solver;
+    const KernelTable<P>* only = nullptr;
+    if (kernel_name != nullptr) {
+        only = FindKernels<P>(kernel_name);
+        if (only == nullptr) {
+            std::printf("Kernel %s is not supported on this machine in %s\n",
+                        kernel_name, P::Name());
+            return false;
+        }
+    }
+    const double bytes = sizeof(typename P::Storage);
+
+    std::printf("%9s  %-6s  %-8s  %10s  %9s  %10s  %8s\n", "dimension", "kernel", "pass",
+                "ns/cell", "stddev", "best", "GB/s");
+    for (int dimension = min_dimension; dimension <= max_dimension; dimension *= 2) {
+        Solver solver(dimension, 0, params);
+        double cells = static_cast<double>(solver.DimensionPlus()) * solver.DimensionPlus();
+
+        for (const KernelTable<P>* const* k = AvailableKernels<P>(); *k != nullptr; k++) {
+            if (only != nullptr && *k != only) continue;
+            const char* kernel = (*k)->name;
+            solver.SetKernels(kernel);
+            VelocityPass<Solver> velocity = { &solver };
+            Report(dimension, kernel, "velocity", Time(velocity, reps), cells,
+                   kVelocityPlanes * bytes);
+            HeightPass<Solver> height = { &solver };
+            Report(dimension, kernel, "height", Time(height, reps), cells,
+                   kHeightPlanes * bytes);
+            FusedPass<Solver> fused = { &solver };
+            Report(dimension, kernel, "fused", Time(fused, reps), cells,
+                   kFusedPlanes * bytes);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    int min_dimension = 64;
+    int max_dimension = 8192;
+    int reps = 10;
+    const char* kernel = nullptr;
+    const char* precision = "float";
+    SolverParams params;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--min") == 0 && a + 1 < argc) {
+            min_dimension = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--max") == 0 && a + 1 < argc) {
+            max_dimension = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--reps") == 0 && a + 1 < argc) {
+            reps = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--kernel") == 0 && a + 1 < argc) {
+            kernel = argv[++a];
+        } else if (strcmp(argv[a], "--layout") == 0 && a + 1 < argc) {
+            if (!ParseGridLayout(argv[++a], &params.layout)) {
+                std::printf("Unknown layout %s\n", argv[a]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[a], "--advection") == 0 && a + 1 < argc) {
+            if (!ParseAdvection(argv[++a], &params.advection)) {
+                std::printf("Unknown advection %s\n", argv[a]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[a], "--precision") == 0 && a + 1 < argc) {
+            precision = argv[++a];
+        } else if (strcmp(argv[a], "--generic") == 0) {
+            params.specialize = false;
+        } else {
+            std::printf("Usage: swe_bench [--min dimension] [--max dimension] [--reps N] [--kernel name]"
+                        " [--layout rows|blocked|morton] [--precision float|double|half]"
+                        " [--advection central|semi-lagrangian|maccormack] [--generic]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (reps < 1) reps = 1;
+
+    bool ok;
+    if (strcmp(precision, "float") == 0) {
+        ok = Sweep<FloatPrecision>(params, min_dimension, max_dimension, reps, kernel);
+    } else if (strcmp(precision, "double") == 0) {
+        ok = Sweep<DoublePrecision>(params, min_dimension, max_dimension, reps, kernel);
+    } else if (strcmp(precision, "half") == 0) {
+        ok = Sweep<HalfPrecision>(params, min_dimension, max_dimension, reps, kernel);
+    } else {
+        std::printf("Unknown precision %s\n", precision);
+        ok = false;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
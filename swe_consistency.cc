@@ -0,0 +1,170 @@
+// Checks that every way the solver can step the grid gives the same
+// heights, bit for bit, as the scalar kernels on one thread with the row
+// layout: each kernel the CPU supports, with and without the fixed-size
+// kernels, on more threads, in tiles, skipping flat tiles, in the blocked
+// layouts, temporally blocked and split among ranks on shared memory.
+// Every run starts from the same seed, so the same rain falls.
+//
+// Usage: swe_consistency [--dimension N] [--steps N]
+//
+// Prints one line per run and returns nonzero if any run differs.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "halo_transport.h"
+#include "shallow_water.h"
+
+const unsigned kSeed = 1;
+const int kMaxDrops = 20;
+
+// Steps a solver with params and kernel from kSeed and copies its heights
+// into heights. Returns false if this CPU cannot run kernel.
+bool Run(int dimension, int steps, const SolverParams& params, const char* kernel,
+         std::vector<float>* heights, int* j0, int* j1) {
+    srand(kSeed);
+    ShallowWaterSolver solver(dimension, kMaxDrops, params);
+    if (!solver.SetKernels(kernel)) {
+        return false;
+    }
+    solver.Advance(steps);
+    heights->resize(static_cast<size_t>(dimension + 1) * (dimension + 1));
+    solver.CopyHeight(&(*heights)[0]);
+    solver.OwnedRows(j0, j1);
+    return true;
+}
+
+// Compares rows [j0, j1) of heights with the reference. Returns false, with
+// the first vertex that differs in *di and *dj, if one does.
+bool Same(const std::vector<float>& reference, const std::vector<float>& heights,
+          int dimension, int j0, int j1, int* di, int* dj) {
+    int dimension_plus = dimension + 1;
+    for (int j = j0; j < j1; j++) {
+        for (int i = 0; i < dimension_plus; i++) {
+            size_t v = static_cast<size_t>(j) * dimension_plus + i;
+            if (std::memcmp(&reference[v], &heights[v], sizeof(float)) != 0) {
+                *di = i;
+                *dj = j;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Runs params with kernel and compares the whole grid with the reference.
+bool Check(const char* name, int dimension, int steps, const SolverParams& params,
+           const char* kernel, const std::vector<float>& reference) {
+    std::vector<float> heights;
+    int j0, j1;
+    if (!Run(dimension, steps, params, kernel, &heights, &j0, &j1)) {
+        std::printf("%-32s skipped, no %s kernels\n", name, kernel);
+        return true;
+    }
+    int i, j;
+    if (Same(reference, heights, dimension, 0, dimension + 1, &i, &j)) {
+        std::printf("%-32s same\n", name);
+        return true;
+    }
+    size_t v = static_cast<size_t>(j) * (dimension + 1) + i;
+    std::printf("%-32s DIFFERENT, vertex (%d, %d) is %.9g instead of %.9g\n",
+                name, i, j, heights[v], reference[v]);
+    return false;
+}
+
+// Splits the grid among ranks forked here, each comparing the rows it owns.
+// Only the calling process returns.
+bool CheckRanks(int ranks, int dimension, int steps, const char* kernel,
+                const std::vector<float>& reference) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%d shm ranks", ranks);
+    HaloTransport* transport = NewShmTransport(ranks, ShallowWaterSolver::HaloBytes(dimension));
+    if (transport == nullptr) {
+        std::printf("%-32s could not start the ranks\n", name);
+        return false;
+    }
+    SolverParams params;
+    params.transport = transport;
+    std::vector<float> heights;
+    int j0, j1;
+    Run(dimension, steps, params, kernel, &heights, &j0, &j1);
+    int i, j;
+    double differs = Same(reference, heights, dimension, j0, j1, &i, &j) ? 0 : 1;
+    transport->MaxAll(&differs, 1);
+    if (transport->Rank() > 0) {
+        delete transport;
+        exit(EXIT_SUCCESS);
+    }
+    std::printf("%-32s %s\n", name, differs == 0 ? "same" : "DIFFERENT");
+    // Waits for the other ranks to exit.
+    delete transport;
+    return differs == 0;
+}
+
+int main(int argc, char* argv[]) {
+    int dimension = 256;
+    int steps = 1500;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--dimension") == 0 && a + 1 < argc) {
+            dimension = atoi(argv[++a]);
+        } else if (strcmp(argv[a], "--steps") == 0 && a + 1 < argc) {
+            steps = atoi(argv[++a]);
+        } else {
+            std::printf("Usage: swe_consistency [--dimension N] [--steps N]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    SolverParams plain;
+    plain.specialize = false;
+    std::vector<float> reference;
+    int j0, j1;
+    Run(dimension, steps, plain, "scalar", &reference, &j0, &j1);
+
+    // The runs past the kernels' own use the widest ones.
+    const char* best = BestKernels<FloatPrecision>()->name;
+    bool ok = true;
+    // The ranks are forked before any run has started worker threads.
+    ok &= CheckRanks(3, dimension, steps, best, reference);
+    ok &= CheckRanks(4, dimension, steps, best, reference);
+
+    for (const KernelTable<FloatPrecision>* const* k = AvailableKernels<FloatPrecision>();
+         *k != nullptr; k++) {
+        std::string name = std::string((*k)->name) + ", fixed size";
+        ok &= Check(name.c_str(), dimension, steps, SolverParams(), (*k)->name, reference);
+        name = std::string((*k)->name) + ", generic";
+        ok &= Check(name.c_str(), dimension, steps, plain, (*k)->name, reference);
+    }
+
+    SolverParams params;
+    params.threads = 3;
+    ok &= Check("3 threads", dimension, steps, params, best, reference);
+    params.tile = 48;
+    ok &= Check("3 threads, tiles of 48", dimension, steps, params, best, reference);
+    params.threads = 1;
+    ok &= Check("1 thread, tiles of 48", dimension, steps, params, best, reference);
+    params.sparse = true;
+    ok &= Check("sparse, tiles of 48", dimension, steps, params, best, reference);
+
+    params = SolverParams();
+    params.layout = kBlocked;
+    ok &= Check("blocked layout", dimension, steps, params, best, reference);
+    params.layout = kMorton;
+    ok &= Check("morton layout", dimension, steps, params, best, reference);
+    params.threads = 3;
+    ok &= Check("morton layout, 3 threads", dimension, steps, params, best, reference);
+
+    params = SolverParams();
+    params.tile = 64;
+    params.temporal_block = 4;
+    ok &= Check("temporal block 4, tiles of 64", dimension, steps, params, best, reference);
+    params.temporal_block = 8;
+    ok &= Check("temporal block 8, tiles of 64", dimension, steps, params, best, reference);
+    params.threads = 3;
+    ok &= Check("temporal block 8, 3 threads", dimension, steps, params, best, reference);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,183 @@
+#include "swe_kernels.h"
+
+#include "swe_stencil.h"
+
+#ifdef SWE_X86_KERNELS
+extern const KernelTable<FloatPrecision> kSseKernels;
+extern const KernelTable<FloatPrecision> kAvx2Kernels;
+extern const KernelTable<FloatPrecision> kAvx512Kernels;
+extern const KernelTable<DoublePrecision> kSseDoubleKernels;
+extern const KernelTable<DoublePrecision> kAvx2DoubleKernels;
+extern const KernelTable<DoublePrecision> kAvx512DoubleKernels;
+extern const KernelTable<HalfPrecision> kAvx2HalfKernels;
+extern const KernelTable<HalfPrecision> kAvx512HalfKernels;
+#endif
+
+namespace {
+
+template <typename P>
+void VelocityRowScalar(const VelocityRowArgs<typename P::Storage>& row,
+                       const StencilConstants<typename P::Compute>& c,
+                       int begin, int end, WaveBounds<typename P::Compute>* bounds) {
+    for (int i = begin; i < end; i++) {
+        VelocityCell<P>(row, c, i, bounds);
+    }
+}
+
+template <typename P>
+void HeightRowScalar(const HeightRowArgs<typename P::Storage>& row,
+                     const StencilConstants<typename P::Compute>& c,
+                     int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        HeightCell<P>(row, c, i);
+    }
+}
+
+template <typename P>
+void AdvectVelocityRowScalar(const FusedPlanes<typename P::Storage>& p,
+                             const StencilConstants<typename P::Compute>& c,
+                             const TraceConstants<typename P::Compute>& t,
+                             int j, int begin, int end,
+                             WaveBounds<typename P::Compute>* bounds) {
+    RowLayout layout = { t.stride };
+    Trace<P, RowLayout> trace(p, layout, t);
+    for (int i = begin; i < end; i++) {
+        AdvectVelocityCell<P>(trace, c, i, j, bounds);
+    }
+}
+
+template <typename P>
+void AdvectHeightRowScalar(const FusedPlanes<typename P::Storage>& p,
+                           const StencilConstants<typename P::Compute>& c,
+                           const TraceConstants<typename P::Compute>& t,
+                           int j, int begin, int end) {
+    RowLayout layout = { t.stride };
+    Trace<P, RowLayout> trace(p, layout, t);
+    for (int i = begin; i < end; i++) {
+        AdvectHeightCell<P>(trace, c, i, j);
+    }
+}
+
+template <typename Precision>
+struct ScalarRows {
+    typedef Precision P;
+    static void Velocity(const VelocityRowArgs<typename P::Storage>& r,
+                         const StencilConstants<typename P::Compute>& c,
+                         int begin, int end, WaveBounds<typename P::Compute>* bounds) {
+        VelocityRowScalar<P>(r, c, begin, end, bounds);
+    }
+    static void Height(const HeightRowArgs<typename P::Storage>& r,
+                       const StencilConstants<typename P::Compute>& c,
+                       int begin, int end) {
+        HeightRowScalar<P>(r, c, begin, end);
+    }
+};
+
+template <typename P>
+struct Tables {
+    static const KernelTable<P> scalar;
+    // The SIMD tables for P, narrowest first, nullptr where an instruction
+    // set has none.
+    static void Simd(const KernelTable<P>* simd[3]);
+};
+
+template <typename P>
+const KernelTable<P> Tables<P>::scalar = {
+    "scalar", 1, VelocityRowScalar<P>, HeightRowScalar<P>,
+    AdvectVelocityRowScalar<P>, AdvectHeightRowScalar<P>,
+    FixedTable<ScalarRows<P>, FixedDimensions>::entries
+};
+
+#ifdef SWE_X86_KERNELS
+template <>
+void Tables<FloatPrecision>::Simd(const KernelTable<FloatPrecision>* simd[3]) {
+    simd[0] = &kSseKernels;
+    simd[1] = &kAvx2Kernels;
+    simd[2] = &kAvx512Kernels;
+}
+
+template <>
+void Tables<DoublePrecision>::Simd(const KernelTable<DoublePrecision>* simd[3]) {
+    simd[0] = &kSseDoubleKernels;
+    simd[1] = &kAvx2DoubleKernels;
+    simd[2] = &kAvx512DoubleKernels;
+}
+
+template <>
+void Tables<HalfPrecision>::Simd(const KernelTable<HalfPrecision>* simd[3]) {
+    simd[0] = nullptr;
+    simd[1] = &kAvx2HalfKernels;
+    simd[2] = &kAvx512HalfKernels;
+}
+#else
+template <typename P>
+void Tables<P>::Simd(const KernelTable<P>* simd[3]) {
+    simd[0] = simd[1] = simd[2] = nullptr;
+}
+#endif
+
+// Whether this CPU can run the SIMD table at position level (0 for sse, 1
+// for avx2, 2 for avx512) in precision P.
+template <typename P>
+bool Supported(int level) {
+#ifdef SWE_X86_KERNELS
+    __builtin_cpu_init();
+    switch (level) {
+        case 0: return __builtin_cpu_supports("sse4.2");
+        case 1: return __builtin_cpu_supports("avx2")
+                       && (sizeof(typename P::Storage) != 2 || __builtin_cpu_supports("f16c"));
+        case 2: return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    (void)level;
+    return false;
+}
+
+template <typename P>
+struct Available {
+    const KernelTable<P>* tables[5];
+
+    Available() {
+        const KernelTable<P>* simd[3];
+        Tables<P>::Simd(simd);
+        int n = 0;
+        tables[n++] = &Tables<P>::scalar;
+        for (int level = 0; level < 3; level++) {
+            if (simd[level] != nullptr && Supported<P>(level)) tables[n++] = simd[level];
+        }
+        for (; n < 5; n++) tables[n] = nullptr;
+    }
+};
+
+}  // namespace
+
+template <typename P>
+const KernelTable<P>* const* AvailableKernels() {
+    static const Available<P> available;
+    return available.tables;
+}
+
+template <typename P>
+const KernelTable<P>* FindKernels(const std::string& name) {
+    for (const KernelTable<P>* const* k = AvailableKernels<P>(); *k != nullptr; k++) {
+        if (name == (*k)->name) return *k;
+    }
+    return nullptr;
+}
+
+template <typename P>
+const KernelTable<P>* BestKernels() {
+    const KernelTable<P>* const* k = AvailableKernels<P>();
+    while (k[1] != nullptr) k++;
+    return *k;
+}
+
+template const KernelTable<FloatPrecision>* const* AvailableKernels<FloatPrecision>();
+template const KernelTable<DoublePrecision>* const* AvailableKernels<DoublePrecision>();
+template const KernelTable<HalfPrecision>* const* AvailableKernels<HalfPrecision>();
+template const KernelTable<FloatPrecision>* FindKernels<FloatPrecision>(const std::string&);
+template const KernelTable<DoublePrecision>* FindKernels<DoublePrecision>(const std::string&);
+template const KernelTable<HalfPrecision>* FindKernels<HalfPrecision>(const std::string&);
+template const KernelTable<FloatPrecision>* BestKernels<FloatPrecision>();
+template const KernelTable<DoublePrecision>* BestKernels<DoublePrecision>();
+template const KernelTable<HalfPrecision>* BestKernels<HalfPrecision>();
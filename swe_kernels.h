@@ -0,0 +1,146 @@
+#ifndef SWE_KERNELS_H
+#define SWE_KERNELS_H
+
+#include <string>
+
+#include "swe_precision.h"
+
+// Row kernels for the shallow water stencils. Every kernel computes columns
+// [begin, end) of one row and reads the neighbours at i - 1 and i + 1, which
+// are ghost cells on the edge of the grid. Each instruction set gets its own
+// translation unit built with the matching -m flags, and the solver picks a
+// table at run time. Everything is templated on the precision (see
+// swe_precision.h) of the planes.
+
+// One row of each plane the velocity stencil reads, plus the rows above and
+// below it.
+template <typename S>
+struct VelocityRowArgs {
+    const S * height, * height_up, * height_down;
+    const S * force, * force_up, * force_down;
+    const S * u, * u_up, * u_down;
+    const S * v, * v_up, * v_down;
+    S * u_out, * v_out;
+};
+
+// One row of each plane the height stencil reads. u and v are the velocities
+// the same step just computed. The force row is cleared as it is consumed.
+template <typename S>
+struct HeightRowArgs {
+    const S * height, * height_up, * height_down;
+    const S * u, * v, * v_up, * v_down;
+    S * height_out, * force;
+};
+
+template <typename C>
+struct StencilConstants {
+    C dt;
+    C gravity;
+    C H;
+    C inv_double_dwater;  // 1 / (2 * dwater)
+};
+
+// What the CFL time step depends on, gathered by the velocity kernels: the
+// largest |u| or |v| they wrote and the largest height they read. Both
+// start at 0, so H + height never underestimates the depth.
+template <typename C>
+struct WaveBounds {
+    C speed;
+    C height;
+};
+
+// The planes one fused sweep reads and writes, each pointing at cell (0, 0)
+// of a row-major grid.
+template <typename S>
+struct FusedPlanes {
+    const S * height, * u, * v;  // the previous step
+    S * force;                   // cleared as it is consumed
+    S * height_out, * u_out, * v_out;
+};
+
+// What the semi-Lagrangian kernels (see advection.h) need to trace cells
+// back along the flow. A trace can reach any row, so they take FusedPlanes
+// and index whole planes, row-major with rows stride elements apart.
+template <typename C>
+struct TraceConstants {
+    C cells_per_speed;  // dt / dwater: cells a unit speed crosses in a step
+    int dimension;
+    int stride;
+    bool maccormack;
+};
+
+// Grid dimensions that get kernels with the grid size compiled in. The
+// build sets the list from SWE_FIXED_DIMENSIONS in CMakeLists.txt.
+#ifndef SWE_FIXED_DIMENSIONS
+#define SWE_FIXED_DIMENSIONS 256, 512, 1024, 2048
+#endif
+
+template <int... kDimensions>
+struct DimensionList {};
+
+typedef DimensionList<SWE_FIXED_DIMENSIONS> FixedDimensions;
+
+// A fused sweep of whole rows for one grid size, dimension_plus cells wide
+// with rows stride elements apart. It does what the solver's velocity and
+// height row loop does for rows [j0, j1), but with the width and the stride
+// known to the compiler, so every row pointer is a constant offset and every
+// row loop has a constant trip count.
+template <typename P>
+struct FixedKernels {
+    typedef void (*FusedRowsKernel)(const FusedPlanes<typename P::Storage>& planes,
+                                    const StencilConstants<typename P::Compute>& c,
+                                    int j0, int j1,
+                                    WaveBounds<typename P::Compute>* bounds);
+
+    int dimension_plus;
+    int stride;
+    FusedRowsKernel fused_rows;
+};
+
+template <typename P>
+struct KernelTable {
+    typedef typename P::Storage S;
+    typedef typename P::Compute C;
+    // With bounds, also raises bounds to cover the cells the kernel wrote.
+    typedef void (*VelocityRowKernel)(const VelocityRowArgs<S>& row,
+                                      const StencilConstants<C>& c,
+                                      int begin, int end, WaveBounds<C>* bounds);
+    typedef void (*HeightRowKernel)(const HeightRowArgs<S>& row,
+                                    const StencilConstants<C>& c,
+                                    int begin, int end);
+    // The same for columns [begin, end) of row j with semi-Lagrangian
+    // advection. The height row reads the velocities the velocity rows
+    // wrote to planes.u_out and planes.v_out.
+    typedef void (*AdvectVelocityRowKernel)(const FusedPlanes<S>& planes,
+                                            const StencilConstants<C>& c,
+                                            const TraceConstants<C>& t,
+                                            int j, int begin, int end,
+                                            WaveBounds<C>* bounds);
+    typedef void (*AdvectHeightRowKernel)(const FusedPlanes<S>& planes,
+                                          const StencilConstants<C>& c,
+                                          const TraceConstants<C>& t,
+                                          int j, int begin, int end);
+
+    const char* name;
+    int width;  // cells per instruction
+    VelocityRowKernel velocity_row;
+    HeightRowKernel height_row;
+    AdvectVelocityRowKernel advect_velocity_row;
+    AdvectHeightRowKernel advect_height_row;
+    // One entry per FixedDimensions, ending with dimension_plus 0.
+    const FixedKernels<P>* fixed;
+};
+
+// Kernels by name: "scalar", "sse", "avx2" or "avx512". Returns nullptr if
+// the name is unknown or this CPU or build cannot run it in precision P.
+template <typename P>
+const KernelTable<P>* FindKernels(const std::string& name);
+// The widest kernels this CPU supports in precision P.
+template <typename P>
+const KernelTable<P>* BestKernels();
+// Every kernel table this CPU can run in precision P, narrowest first,
+// ending in nullptr.
+template <typename P>
+const KernelTable<P>* const* AvailableKernels();
+
+#endif
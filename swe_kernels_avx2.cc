@@ -0,0 +1,120 @@
+// AVX2 kernels, 8 floats or 4 doubles per instruction. Built with -mavx2
+// and -mf16c, which the half kernels use to convert 8 halves at a time.
+// The semi-Lagrangian kernels gather their interpolation corners.
+
+#include <immintrin.h>
+
+#include "swe_stencil.h"
+
+namespace {
+
+struct Avx2Vec {
+    typedef FloatPrecision P;
+    typedef __m256 T;
+    static const int kWidth = 8;
+    static T Set(float x) { return _mm256_set1_ps(x); }
+    static T Load(const float* p) { return _mm256_loadu_ps(p); }
+    static void Store(float* p, T x) { _mm256_storeu_ps(p, x); }
+    static T Add(T a, T b) { return _mm256_add_ps(a, b); }
+    static T Sub(T a, T b) { return _mm256_sub_ps(a, b); }
+    static T Mul(T a, T b) { return _mm256_mul_ps(a, b); }
+    static T Neg(T a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+    static T Abs(T a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static T Min(T a, T b) { return _mm256_min_ps(a, b); }
+    static T Max(T a, T b) { return _mm256_max_ps(a, b); }
+    static float MaxLane(T a) {
+        __m128 m = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+        return _mm_cvtss_f32(_mm_max_ss(m, _mm_shuffle_ps(m, m, 1)));
+    }
+
+    typedef __m256i I;
+    static I SetIndex(int x) { return _mm256_set1_epi32(x); }
+    static I Lanes() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+    static I AddIndex(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I MulIndex(I a, I b) { return _mm256_mullo_epi32(a, b); }
+    static I MinIndex(I a, I b) { return _mm256_min_epi32(a, b); }
+    static I Truncate(T a) { return _mm256_cvttps_epi32(a); }
+    static T Convert(I a) { return _mm256_cvtepi32_ps(a); }
+    typedef __m256 M;
+    static M Less(T a, T b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static T Select(M m, T a, T b) { return _mm256_blendv_ps(b, a, m); }
+    static bool Any(M m) { return _mm256_movemask_ps(m) != 0; }
+    static T Gather(const float* p, I index) { return _mm256_i32gather_ps(p, index, 4); }
+};
+
+struct Avx2DoubleVec {
+    typedef DoublePrecision P;
+    typedef __m256d T;
+    static const int kWidth = 4;
+    static T Set(double x) { return _mm256_set1_pd(x); }
+    static T Load(const double* p) { return _mm256_loadu_pd(p); }
+    static void Store(double* p, T x) { _mm256_storeu_pd(p, x); }
+    static T Add(T a, T b) { return _mm256_add_pd(a, b); }
+    static T Sub(T a, T b) { return _mm256_sub_pd(a, b); }
+    static T Mul(T a, T b) { return _mm256_mul_pd(a, b); }
+    static T Neg(T a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+    static T Abs(T a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+    static T Min(T a, T b) { return _mm256_min_pd(a, b); }
+    static T Max(T a, T b) { return _mm256_max_pd(a, b); }
+    static double MaxLane(T a) {
+        __m128d m = _mm_max_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+        return _mm_cvtsd_f64(_mm_max_sd(m, _mm_unpackhi_pd(m, m)));
+    }
+
+    typedef __m128i I;
+    static I SetIndex(int x) { return _mm_set1_epi32(x); }
+    static I Lanes() { return _mm_setr_epi32(0, 1, 2, 3); }
+    static I AddIndex(I a, I b) { return _mm_add_epi32(a, b); }
+    static I MulIndex(I a, I b) { return _mm_mullo_epi32(a, b); }
+    static I MinIndex(I a, I b) { return _mm_min_epi32(a, b); }
+    static I Truncate(T a) { return _mm256_cvttpd_epi32(a); }
+    static T Convert(I a) { return _mm256_cvtepi32_pd(a); }
+    typedef __m256d M;
+    static M Less(T a, T b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static T Select(M m, T a, T b) { return _mm256_blendv_pd(b, a, m); }
+    static bool Any(M m) { return _mm256_movemask_pd(m) != 0; }
+    static T Gather(const double* p, I index) { return _mm256_i32gather_pd(p, index, 8); }
+};
+
+// Float arithmetic on half storage. F16C rounds to nearest even, as glm's
+// packHalf1x16 does, so these match the scalar half kernels.
+struct Avx2HalfVec : Avx2Vec {
+    typedef HalfPrecision P;
+    static T Load(const uint16_t* p) {
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+    static void Store(uint16_t* p, T x) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p),
+                         _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT));
+    }
+    // There is no 16-bit gather, so gather the 32 bits at each half and
+    // pack the low halves together. The two bytes past a corner are always
+    // another cell of the plane.
+    static T Gather(const uint16_t* p, I index) {
+        I words = _mm256_i32gather_epi32(reinterpret_cast<const int*>(p), index, 2);
+        words = _mm256_and_si256(words, _mm256_set1_epi32(0xffff));
+        words = _mm256_permute4x64_epi64(_mm256_packus_epi32(words, words), 0x08);
+        return _mm256_cvtph_ps(_mm256_castsi256_si128(words));
+    }
+};
+
+}  // namespace
+
+extern const KernelTable<FloatPrecision> kAvx2Kernels = {
+    "avx2", Avx2Vec::kWidth, VelocityRowSimd<Avx2Vec>, HeightRowSimd<Avx2Vec>,
+    AdvectVelocityRowSimd<Avx2Vec>, AdvectHeightRowSimd<Avx2Vec>,
+    FixedTable<SimdRows<Avx2Vec>, FixedDimensions>::entries
+};
+
+extern const KernelTable<DoublePrecision> kAvx2DoubleKernels = {
+    "avx2", Avx2DoubleVec::kWidth, VelocityRowSimd<Avx2DoubleVec>, HeightRowSimd<Avx2DoubleVec>,
+    AdvectVelocityRowSimd<Avx2DoubleVec>, AdvectHeightRowSimd<Avx2DoubleVec>,
+    FixedTable<SimdRows<Avx2DoubleVec>, FixedDimensions>::entries
+};
+
+extern const KernelTable<HalfPrecision> kAvx2HalfKernels = {
+    "avx2", Avx2HalfVec::kWidth, VelocityRowSimd<Avx2HalfVec>, HeightRowSimd<Avx2HalfVec>,
+    AdvectVelocityRowSimd<Avx2HalfVec>, AdvectHeightRowSimd<Avx2HalfVec>,
+    FixedTable<SimdRows<Avx2HalfVec>, FixedDimensions>::entries
+};
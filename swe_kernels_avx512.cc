@@ -0,0 +1,116 @@
+// AVX-512 kernels, 16 floats or 8 doubles per instruction. Built with
+// -mavx512f, which also converts 16 halves at a time. The semi-Lagrangian
+// kernels gather their interpolation corners.
+
+#include <immintrin.h>
+
+#include "swe_stencil.h"
+
+namespace {
+
+struct Avx512Vec {
+    typedef FloatPrecision P;
+    typedef __m512 T;
+    static const int kWidth = 16;
+    static T Set(float x) { return _mm512_set1_ps(x); }
+    static T Load(const float* p) { return _mm512_loadu_ps(p); }
+    static void Store(float* p, T x) { _mm512_storeu_ps(p, x); }
+    static T Add(T a, T b) { return _mm512_add_ps(a, b); }
+    static T Sub(T a, T b) { return _mm512_sub_ps(a, b); }
+    static T Mul(T a, T b) { return _mm512_mul_ps(a, b); }
+    // _mm512_xor_ps needs AVX512DQ, so flip the sign bit as an integer.
+    static T Neg(T a) {
+        return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a),
+                                                    _mm512_set1_epi32(0x80000000)));
+    }
+    static T Abs(T a) { return _mm512_abs_ps(a); }
+    static T Min(T a, T b) { return _mm512_min_ps(a, b); }
+    static T Max(T a, T b) { return _mm512_max_ps(a, b); }
+    static float MaxLane(T a) { return _mm512_reduce_max_ps(a); }
+
+    typedef __m512i I;
+    static I SetIndex(int x) { return _mm512_set1_epi32(x); }
+    static I Lanes() {
+        return _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    }
+    static I AddIndex(I a, I b) { return _mm512_add_epi32(a, b); }
+    static I MulIndex(I a, I b) { return _mm512_mullo_epi32(a, b); }
+    static I MinIndex(I a, I b) { return _mm512_min_epi32(a, b); }
+    static I Truncate(T a) { return _mm512_cvttps_epi32(a); }
+    static T Convert(I a) { return _mm512_cvtepi32_ps(a); }
+    typedef __mmask16 M;
+    static M Less(T a, T b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static T Select(M m, T a, T b) { return _mm512_mask_blend_ps(m, b, a); }
+    static bool Any(M m) { return m != 0; }
+    static T Gather(const float* p, I index) { return _mm512_i32gather_ps(index, p, 4); }
+};
+
+struct Avx512DoubleVec {
+    typedef DoublePrecision P;
+    typedef __m512d T;
+    static const int kWidth = 8;
+    static T Set(double x) { return _mm512_set1_pd(x); }
+    static T Load(const double* p) { return _mm512_loadu_pd(p); }
+    static void Store(double* p, T x) { _mm512_storeu_pd(p, x); }
+    static T Add(T a, T b) { return _mm512_add_pd(a, b); }
+    static T Sub(T a, T b) { return _mm512_sub_pd(a, b); }
+    static T Mul(T a, T b) { return _mm512_mul_pd(a, b); }
+    static T Neg(T a) {
+        return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a),
+                                                    _mm512_set1_epi64(0x8000000000000000LL)));
+    }
+    static T Abs(T a) { return _mm512_abs_pd(a); }
+    static T Min(T a, T b) { return _mm512_min_pd(a, b); }
+    static T Max(T a, T b) { return _mm512_max_pd(a, b); }
+    static double MaxLane(T a) { return _mm512_reduce_max_pd(a); }
+
+    typedef __m256i I;
+    static I SetIndex(int x) { return _mm256_set1_epi32(x); }
+    static I Lanes() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+    static I AddIndex(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I MulIndex(I a, I b) { return _mm256_mullo_epi32(a, b); }
+    static I MinIndex(I a, I b) { return _mm256_min_epi32(a, b); }
+    static I Truncate(T a) { return _mm512_cvttpd_epi32(a); }
+    static T Convert(I a) { return _mm512_cvtepi32_pd(a); }
+    typedef __mmask8 M;
+    static M Less(T a, T b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static T Select(M m, T a, T b) { return _mm512_mask_blend_pd(m, b, a); }
+    static bool Any(M m) { return m != 0; }
+    static T Gather(const double* p, I index) { return _mm512_i32gather_pd(index, p, 8); }
+};
+
+struct Avx512HalfVec : Avx512Vec {
+    typedef HalfPrecision P;
+    static T Load(const uint16_t* p) {
+        return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    }
+    static void Store(uint16_t* p, T x) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p),
+                            _mm512_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT));
+    }
+    // Gathers the 32 bits at each half, as the AVX2 half kernels do.
+    static T Gather(const uint16_t* p, I index) {
+        I words = _mm512_i32gather_epi32(index, reinterpret_cast<const int*>(p), 2);
+        return _mm512_cvtph_ps(_mm512_cvtepi32_epi16(words));
+    }
+};
+
+}  // namespace
+
+extern const KernelTable<FloatPrecision> kAvx512Kernels = {
+    "avx512", Avx512Vec::kWidth, VelocityRowSimd<Avx512Vec>, HeightRowSimd<Avx512Vec>,
+    AdvectVelocityRowSimd<Avx512Vec>, AdvectHeightRowSimd<Avx512Vec>,
+    FixedTable<SimdRows<Avx512Vec>, FixedDimensions>::entries
+};
+
+extern const KernelTable<DoublePrecision> kAvx512DoubleKernels = {
+    "avx512", Avx512DoubleVec::kWidth, VelocityRowSimd<Avx512DoubleVec>, HeightRowSimd<Avx512DoubleVec>,
+    AdvectVelocityRowSimd<Avx512DoubleVec>, AdvectHeightRowSimd<Avx512DoubleVec>,
+    FixedTable<SimdRows<Avx512DoubleVec>, FixedDimensions>::entries
+};
+
+extern const KernelTable<HalfPrecision> kAvx512HalfKernels = {
+    "avx512", Avx512HalfVec::kWidth, VelocityRowSimd<Avx512HalfVec>, HeightRowSimd<Avx512HalfVec>,
+    AdvectVelocityRowSimd<Avx512HalfVec>, AdvectHeightRowSimd<Avx512HalfVec>,
+    FixedTable<SimdRows<Avx512HalfVec>, FixedDimensions>::entries
+};
@@ -0,0 +1,96 @@
+// SSE4.2 kernels, 4 floats or 2 doubles per instruction. Built with
+// -msse4.2. Half storage needs F16C, so there are no SSE half kernels.
+// SSE has no gather, so Gather loads the lanes one at a time.
+
+#include <immintrin.h>
+
+#include "swe_stencil.h"
+
+namespace {
+
+struct SseVec {
+    typedef FloatPrecision P;
+    typedef __m128 T;
+    static const int kWidth = 4;
+    static T Set(float x) { return _mm_set1_ps(x); }
+    static T Load(const float* p) { return _mm_loadu_ps(p); }
+    static void Store(float* p, T x) { _mm_storeu_ps(p, x); }
+    static T Add(T a, T b) { return _mm_add_ps(a, b); }
+    static T Sub(T a, T b) { return _mm_sub_ps(a, b); }
+    static T Mul(T a, T b) { return _mm_mul_ps(a, b); }
+    static T Neg(T a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    static T Abs(T a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static T Min(T a, T b) { return _mm_min_ps(a, b); }
+    static T Max(T a, T b) { return _mm_max_ps(a, b); }
+    static float MaxLane(T a) {
+        a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+        return _mm_cvtss_f32(_mm_max_ss(a, _mm_shuffle_ps(a, a, 1)));
+    }
+
+    typedef __m128i I;
+    static I SetIndex(int x) { return _mm_set1_epi32(x); }
+    static I Lanes() { return _mm_setr_epi32(0, 1, 2, 3); }
+    static I AddIndex(I a, I b) { return _mm_add_epi32(a, b); }
+    static I MulIndex(I a, I b) { return _mm_mullo_epi32(a, b); }
+    static I MinIndex(I a, I b) { return _mm_min_epi32(a, b); }
+    static I Truncate(T a) { return _mm_cvttps_epi32(a); }
+    static T Convert(I a) { return _mm_cvtepi32_ps(a); }
+    typedef __m128 M;
+    static M Less(T a, T b) { return _mm_cmplt_ps(a, b); }
+    static T Select(M m, T a, T b) { return _mm_blendv_ps(b, a, m); }
+    static bool Any(M m) { return _mm_movemask_ps(m) != 0; }
+    static T Gather(const float* p, I index) {
+        return _mm_setr_ps(p[_mm_cvtsi128_si32(index)], p[_mm_extract_epi32(index, 1)],
+                           p[_mm_extract_epi32(index, 2)], p[_mm_extract_epi32(index, 3)]);
+    }
+};
+
+struct SseDoubleVec {
+    typedef DoublePrecision P;
+    typedef __m128d T;
+    static const int kWidth = 2;
+    static T Set(double x) { return _mm_set1_pd(x); }
+    static T Load(const double* p) { return _mm_loadu_pd(p); }
+    static void Store(double* p, T x) { _mm_storeu_pd(p, x); }
+    static T Add(T a, T b) { return _mm_add_pd(a, b); }
+    static T Sub(T a, T b) { return _mm_sub_pd(a, b); }
+    static T Mul(T a, T b) { return _mm_mul_pd(a, b); }
+    static T Neg(T a) { return _mm_xor_pd(a, _mm_set1_pd(-0.0)); }
+    static T Abs(T a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+    static T Min(T a, T b) { return _mm_min_pd(a, b); }
+    static T Max(T a, T b) { return _mm_max_pd(a, b); }
+    static double MaxLane(T a) {
+        return _mm_cvtsd_f64(_mm_max_sd(a, _mm_unpackhi_pd(a, a)));
+    }
+
+    // The indices of the two lanes are the low two of an I.
+    typedef __m128i I;
+    static I SetIndex(int x) { return _mm_set1_epi32(x); }
+    static I Lanes() { return _mm_setr_epi32(0, 1, 0, 0); }
+    static I AddIndex(I a, I b) { return _mm_add_epi32(a, b); }
+    static I MulIndex(I a, I b) { return _mm_mullo_epi32(a, b); }
+    static I MinIndex(I a, I b) { return _mm_min_epi32(a, b); }
+    static I Truncate(T a) { return _mm_cvttpd_epi32(a); }
+    static T Convert(I a) { return _mm_cvtepi32_pd(a); }
+    typedef __m128d M;
+    static M Less(T a, T b) { return _mm_cmplt_pd(a, b); }
+    static T Select(M m, T a, T b) { return _mm_blendv_pd(b, a, m); }
+    static bool Any(M m) { return _mm_movemask_pd(m) != 0; }
+    static T Gather(const double* p, I index) {
+        return _mm_setr_pd(p[_mm_cvtsi128_si32(index)], p[_mm_extract_epi32(index, 1)]);
+    }
+};
+
+}  // namespace
+
+extern const KernelTable<FloatPrecision> kSseKernels = {
+    "sse", SseVec::kWidth, VelocityRowSimd<SseVec>, HeightRowSimd<SseVec>,
+    AdvectVelocityRowSimd<SseVec>, AdvectHeightRowSimd<SseVec>,
+    FixedTable<SimdRows<SseVec>, FixedDimensions>::entries
+};
+
+extern const KernelTable<DoublePrecision> kSseDoubleKernels = {
+    "sse", SseDoubleVec::kWidth, VelocityRowSimd<SseDoubleVec>, HeightRowSimd<SseDoubleVec>,
+    AdvectVelocityRowSimd<SseDoubleVec>, AdvectHeightRowSimd<SseDoubleVec>,
+    FixedTable<SimdRows<SseDoubleVec>, FixedDimensions>::entries
+};
@@ -0,0 +1,43 @@
+#include "swe_precision.h"
+
+#include <cstring>
+
+#include <glm/gtc/packing.hpp>
+
+HalfPrecision::Compute HalfPrecision::Load(Storage x) {
+    return glm::unpackHalf1x16(x);
+}
+
+HalfPrecision::Storage HalfPrecision::Store(Compute x) {
+    // glm::packHalf1x16 rounds halfway subnormals up rather than to even, so
+    // it disagrees with the F16C and AVX-512 conversions the SIMD kernels
+    // use on the small heights near rest. Round to nearest even everywhere.
+    const uint32_t half_overflow = (127 + 16) << 23;  // 65536.0f
+    const uint32_t float_infinity = 255 << 23;
+    const uint32_t half_normal = (127 - 14) << 23;    // smallest normal half
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    if (bits >= half_overflow) {
+        return sign | (bits > float_infinity ? 0x7e00 : 0x7c00);
+    }
+    if (bits < half_normal) {
+        // Adding 0.5 lines the half's subnormal bits up with the low bits of
+        // the float's mantissa, and the float addition does the rounding.
+        const float magic = 0.5f;
+        uint32_t magic_bits;
+        std::memcpy(&magic_bits, &magic, sizeof(magic_bits));
+        float sum;
+        std::memcpy(&sum, &bits, sizeof(sum));
+        sum += magic;
+        std::memcpy(&bits, &sum, sizeof(bits));
+        return sign | (bits - magic_bits);
+    }
+    // Rebias the exponent and round the 13 dropped mantissa bits to even. A
+    // carry out of the mantissa bumps the exponent, up to infinity.
+    uint32_t odd = (bits >> 13) & 1;
+    bits += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+    return sign | (bits >> 13);
+}
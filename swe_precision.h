@@ -0,0 +1,42 @@
+#ifndef SWE_PRECISION_H
+#define SWE_PRECISION_H
+
+// The scalar types the solver can run in. Each precision names the type the
+// planes are stored in and the type the stencils compute in, and converts
+// between the two. The solver and every kernel are templated on one of
+// these, so all precisions share the same code.
+
+#include <stdint.h>
+
+// Interactive use: float storage and arithmetic.
+struct FloatPrecision {
+    typedef float Storage;
+    typedef float Compute;
+    static const char* Name() { return "float"; }
+    static Compute Load(Storage x) { return x; }
+    static Storage Store(Compute x) { return x; }
+};
+
+// Long validation runs: double storage and arithmetic.
+struct DoublePrecision {
+    typedef double Storage;
+    typedef double Compute;
+    static const char* Name() { return "double"; }
+    static Compute Load(Storage x) { return x; }
+    static Storage Store(Compute x) { return x; }
+};
+
+// Huge grids: IEEE half storage, which halves the memory traffic, and float
+// arithmetic. Loads use glm's unpackHalf1x16 and stores round to nearest
+// even like the F16C instructions. Both are defined out of line in
+// swe_precision.cc so that the kernel files, which are built with -m flags,
+// never provide a copy the rest of the program could link against.
+struct HalfPrecision {
+    typedef uint16_t Storage;
+    typedef float Compute;
+    static const char* Name() { return "half"; }
+    static Compute Load(Storage x);
+    static Storage Store(Compute x);
+};
+
+#endif
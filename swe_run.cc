@@ -0,0 +1,22 @@
+// Headless runs without the window, for machines that have no OpenGL, GLEW
+// or GLFW to build it against.
+//
+// Usage: swe_run [options] dimension maxraindrops
+//
+// Takes the same options as ./runit.sh --headless (see headless.h) and
+// prints the same report.
+
+#include <cstdlib>
+#include <iostream>
+
+#include "headless.h"
+
+int main(int argc, char* argv[]) {
+    RunOptions options;
+    if (!ParseRunOptions(argc, argv, &options)) {
+        std::cout << "Usage: swe_run " << kRunOptionsUsage << std::endl;
+        return EXIT_FAILURE;
+    }
+    RunHeadless(options);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,729 @@
+#ifndef SWE_STENCIL_H
+#define SWE_STENCIL_H
+
+// Stencil bodies shared by the kernel translation units. Everything here has
+// internal linkage: each kernel file is built with different -m flags, and a
+// shared inline definition could otherwise be resolved to a copy that uses
+// instructions the CPU does not have.
+//
+// The cells are templated on the precision P and the vector loops on a
+// wrapper V for one register type and precision. The vector loops evaluate
+// the same expressions in the same order as the scalar cells, so every
+// kernel of a precision produces bit-identical results. A row that
+// does not divide into whole vectors ends with one vector that overlaps the
+// previous one; recomputing a cell writes the same value, since no cell
+// reads what its own row writes.
+
+#include "grid_layout.h"
+#include "swe_kernels.h"
+
+namespace {
+
+// Scalar max and abs that behave like the SIMD Max and Abs, written out
+// rather than taken from <algorithm> for the reason above.
+template <typename C>
+inline C MaxOf(C a, C b) {
+    return a > b ? a : b;
+}
+
+template <typename C>
+inline C MinOf(C a, C b) {
+    return a < b ? a : b;
+}
+
+template <typename C>
+inline C AbsOf(C a) {
+    return a < 0 ? -a : a;
+}
+
+template <typename C>
+inline C Lerp(C a, C b, C t) {
+    return a + (b - a) * t;
+}
+
+template <typename P>
+inline void VelocityCell(const VelocityRowArgs<typename P::Storage>& r,
+                         const StencilConstants<typename P::Compute>& c, int i,
+                         WaveBounds<typename P::Compute>* bounds) {
+    typedef typename P::Compute C;
+    C u = P::Load(r.u[i]);
+    C v = P::Load(r.v[i]);
+    C height_grad_i = (P::Load(r.height[i + 1]) - P::Load(r.height[i - 1])) * c.inv_double_dwater;
+    C height_grad_j = (P::Load(r.height_down[i]) - P::Load(r.height_up[i])) * c.inv_double_dwater;
+    C force_grad_i  = (P::Load(r.force[i + 1]) - P::Load(r.force[i - 1])) * c.inv_double_dwater;
+    C force_grad_j  = (P::Load(r.force_down[i]) - P::Load(r.force_up[i])) * c.inv_double_dwater;
+    C du_di = (P::Load(r.u[i + 1]) - P::Load(r.u[i - 1])) * c.inv_double_dwater;
+    C dv_di = (P::Load(r.v[i + 1]) - P::Load(r.v[i - 1])) * c.inv_double_dwater;
+    C du_dj = (P::Load(r.u_down[i]) - P::Load(r.u_up[i])) * c.inv_double_dwater;
+    C dv_dj = (P::Load(r.v_down[i]) - P::Load(r.v_up[i])) * c.inv_double_dwater;
+
+    C pressure = -(c.gravity + P::Load(r.force[i]));
+    C u_new = (pressure * height_grad_i - C(1.7) * force_grad_i
+               - u * du_di - v * du_dj) * c.dt + u;
+    C v_new = (pressure * height_grad_j - C(1.7) * force_grad_j
+               - u * dv_di - v * dv_dj) * c.dt + v;
+    r.u_out[i] = P::Store(u_new);
+    r.v_out[i] = P::Store(v_new);
+    if (bounds != nullptr) {
+        bounds->speed = MaxOf(bounds->speed, MaxOf(AbsOf(u_new), AbsOf(v_new)));
+        bounds->height = MaxOf(bounds->height, P::Load(r.height[i]));
+    }
+}
+
+template <typename P>
+inline void HeightCell(const HeightRowArgs<typename P::Storage>& r,
+                       const StencilConstants<typename P::Compute>& c, int i) {
+    typedef typename P::Compute C;
+    // The velocity update has already applied the drops' force as extra
+    // pressure, so a drop pushes for one step only.
+    r.force[i] = 0;
+    C u = P::Load(r.u[i]);
+    C v = P::Load(r.v[i]);
+    C height = P::Load(r.height[i]);
+    C vel_grad_x = (P::Load(r.u[i + 1]) - P::Load(r.u[i - 1])) * c.inv_double_dwater;
+    C u_dhdx = u * (P::Load(r.height[i + 1]) - P::Load(r.height[i - 1])) * c.inv_double_dwater;
+    C vel_grad_y = (P::Load(r.v_down[i]) - P::Load(r.v_up[i])) * c.inv_double_dwater;
+    C v_dhdy = v * (P::Load(r.height_down[i]) - P::Load(r.height_up[i])) * c.inv_double_dwater;
+    r.height_out[i] = P::Store((-(height + c.H) * (vel_grad_x + vel_grad_y) - u_dhdx - v_dhdy)
+                               * c.dt + height);
+}
+
+// Semi-Lagrangian tracing through the planes of layout L. The kernels use
+// RowLayout; the solver uses the same cells for blocks. A trace is clamped
+// to the grid and the cell it interpolates from kept inside it, so no ghost
+// cell is ever read.
+template <typename P, typename L>
+struct Trace {
+    typedef typename P::Storage S;
+    typedef typename P::Compute C;
+
+    // The cell before a traced point and how far past it the point is.
+    struct Point {
+        int x0, y0;
+        C fx, fy;
+    };
+
+    const FusedPlanes<S>& planes;
+    const L& layout;
+    int dimension;
+    bool maccormack;
+    C back, forward;  // cells per unit speed, with the sign of the trace
+
+    Trace(const FusedPlanes<S>& planes, const L& layout, const TraceConstants<C>& t) :
+            planes(planes),
+            layout(layout),
+            dimension(t.dimension),
+            maccormack(t.maccormack),
+            back(-t.cells_per_speed),
+            forward(t.cells_per_speed) {}
+
+    void Split(C x, int* x0, C* fraction) const {
+        x = MinOf(MaxOf(x, C(0)), C(dimension));
+        *x0 = MinOf((int)x, dimension - 1);
+        *fraction = x - C(*x0);
+    }
+
+    // Where cell (i, j) moves in one step along the previous velocities.
+    Point Move(int i, int j, C step) const {
+        int cell = layout.Index(i, j);
+        Point p;
+        Split(C(i) + P::Load(planes.u[cell]) * step, &p.x0, &p.fx);
+        Split(C(j) + P::Load(planes.v[cell]) * step, &p.y0, &p.fy);
+        return p;
+    }
+
+    void Corners(const S* plane, const Point& p, C corner[4]) const {
+        corner[0] = P::Load(plane[layout.Index(p.x0, p.y0)]);
+        corner[1] = P::Load(plane[layout.Index(p.x0 + 1, p.y0)]);
+        corner[2] = P::Load(plane[layout.Index(p.x0, p.y0 + 1)]);
+        corner[3] = P::Load(plane[layout.Index(p.x0 + 1, p.y0 + 1)]);
+    }
+
+    static C Bilinear(const C corner[4], C fx, C fy) {
+        return Lerp(Lerp(corner[0], corner[1], fx), Lerp(corner[2], corner[3], fx), fy);
+    }
+
+    // The values n planes (at most 2) carry to cell (i, j) in one step.
+    //
+    // MacCormack carries the result forward again, which should give back
+    // the previous value, and adds half the difference. The sum is clamped
+    // to the four cells the back trace interpolated, so it cannot make new
+    // extrema.
+    void Advect(const S* const* plane, int n, int i, int j, C* out) const {
+        Point p = Move(i, j, back);
+        C corner[2][4];
+        for (int k = 0; k < n; k++) {
+            Corners(plane[k], p, corner[k]);
+            out[k] = Bilinear(corner[k], p.fx, p.fy);
+        }
+        if (!maccormack) {
+            return;
+        }
+        Point q = Move(i, j, forward);
+        C carried[2][4];
+        for (int c = 0; c < 4; c++) {
+            Point r = Move(q.x0 + (c & 1), q.y0 + (c >> 1), back);
+            for (int k = 0; k < n; k++) {
+                C moved[4];
+                Corners(plane[k], r, moved);
+                carried[k][c] = Bilinear(moved, r.fx, r.fy);
+            }
+        }
+        for (int k = 0; k < n; k++) {
+            C round_trip = Bilinear(carried[k], q.fx, q.fy);
+            C error = P::Load(plane[k][layout.Index(i, j)]) - round_trip;
+            C lo = MinOf(MinOf(corner[k][0], corner[k][1]), MinOf(corner[k][2], corner[k][3]));
+            C hi = MaxOf(MaxOf(corner[k][0], corner[k][1]), MaxOf(corner[k][2], corner[k][3]));
+            out[k] = MinOf(MaxOf(out[k] + C(0.5) * error, lo), hi);
+        }
+    }
+};
+
+// VelocityCell() with the velocities carried by the flow in place of the
+// central difference advection terms.
+template <typename P, typename L>
+inline void AdvectVelocityCell(const Trace<P, L>& trace,
+                               const StencilConstants<typename P::Compute>& c,
+                               int i, int j, WaveBounds<typename P::Compute>* bounds) {
+    typedef typename P::Storage S;
+    typedef typename P::Compute C;
+    const FusedPlanes<S>& p = trace.planes;
+    const L& l = trace.layout;
+    const S* const velocity[2] = { p.u, p.v };
+    C carried[2];
+    trace.Advect(velocity, 2, i, j, carried);
+    int cell = l.Index(i, j);
+    int left = l.Index(i - 1, j), right = l.Index(i + 1, j);
+    int up = l.Index(i, j - 1), down = l.Index(i, j + 1);
+    C height_grad_i = (P::Load(p.height[right]) - P::Load(p.height[left])) * c.inv_double_dwater;
+    C height_grad_j = (P::Load(p.height[down]) - P::Load(p.height[up])) * c.inv_double_dwater;
+    C force_grad_i  = (P::Load(p.force[right]) - P::Load(p.force[left])) * c.inv_double_dwater;
+    C force_grad_j  = (P::Load(p.force[down]) - P::Load(p.force[up])) * c.inv_double_dwater;
+
+    C pressure = -(c.gravity + P::Load(p.force[cell]));
+    C u_new = (pressure * height_grad_i - C(1.7) * force_grad_i) * c.dt + carried[0];
+    C v_new = (pressure * height_grad_j - C(1.7) * force_grad_j) * c.dt + carried[1];
+    p.u_out[cell] = P::Store(u_new);
+    p.v_out[cell] = P::Store(v_new);
+    if (bounds != nullptr) {
+        bounds->speed = MaxOf(bounds->speed, MaxOf(AbsOf(u_new), AbsOf(v_new)));
+        bounds->height = MaxOf(bounds->height, P::Load(p.height[cell]));
+    }
+}
+
+// HeightCell() with the height carried by the flow in place of the central
+// difference advection terms.
+template <typename P, typename L>
+inline void AdvectHeightCell(const Trace<P, L>& trace,
+                             const StencilConstants<typename P::Compute>& c, int i, int j) {
+    typedef typename P::Storage S;
+    typedef typename P::Compute C;
+    const FusedPlanes<S>& p = trace.planes;
+    const L& l = trace.layout;
+    int cell = l.Index(i, j);
+    p.force[cell] = 0;
+    C carried;
+    trace.Advect(&p.height, 1, i, j, &carried);
+    C vel_grad_x = (P::Load(p.u_out[l.Index(i + 1, j)]) - P::Load(p.u_out[l.Index(i - 1, j)]))
+                   * c.inv_double_dwater;
+    C vel_grad_y = (P::Load(p.v_out[l.Index(i, j + 1)]) - P::Load(p.v_out[l.Index(i, j - 1)]))
+                   * c.inv_double_dwater;
+    p.height_out[cell] = P::Store(-(carried + c.H) * (vel_grad_x + vel_grad_y) * c.dt + carried);
+}
+
+// V wraps one SIMD register type: P (the precision), T (the register),
+// kWidth lanes, Set (broadcast a P::Compute), Load and Store (unaligned,
+// converting from and to P::Storage), Add, Sub, Mul, Neg (sign flip), Abs,
+// Min, Max and MaxLane (the largest lane as a P::Compute).
+//
+// With kBounds the velocity vector also keeps the lane-wise WaveBounds of
+// every cell it computes, for Merge() to fold into a WaveBounds at the end
+// of the row.
+template <typename V, bool kBounds>
+struct VelocityVector {
+    typedef typename V::T T;
+    T inv, gravity, force_coeff, dt;
+    T speed, height;
+
+    explicit VelocityVector(const StencilConstants<typename V::P::Compute>& c) :
+            inv(V::Set(c.inv_double_dwater)),
+            gravity(V::Set(c.gravity)),
+            force_coeff(V::Set(1.7)),
+            dt(V::Set(c.dt)),
+            speed(V::Set(0)),
+            height(V::Set(0)) {}
+
+    void Merge(WaveBounds<typename V::P::Compute>* bounds) const {
+        bounds->speed = MaxOf(bounds->speed, V::MaxLane(speed));
+        bounds->height = MaxOf(bounds->height, V::MaxLane(height));
+    }
+
+    void operator()(const VelocityRowArgs<typename V::P::Storage>& r, int i) {
+        T u = V::Load(r.u + i);
+        T v = V::Load(r.v + i);
+        T height_grad_i = V::Mul(V::Sub(V::Load(r.height + i + 1), V::Load(r.height + i - 1)), inv);
+        T height_grad_j = V::Mul(V::Sub(V::Load(r.height_down + i), V::Load(r.height_up + i)), inv);
+        T force_grad_i  = V::Mul(V::Sub(V::Load(r.force + i + 1), V::Load(r.force + i - 1)), inv);
+        T force_grad_j  = V::Mul(V::Sub(V::Load(r.force_down + i), V::Load(r.force_up + i)), inv);
+        T du_di = V::Mul(V::Sub(V::Load(r.u + i + 1), V::Load(r.u + i - 1)), inv);
+        T dv_di = V::Mul(V::Sub(V::Load(r.v + i + 1), V::Load(r.v + i - 1)), inv);
+        T du_dj = V::Mul(V::Sub(V::Load(r.u_down + i), V::Load(r.u_up + i)), inv);
+        T dv_dj = V::Mul(V::Sub(V::Load(r.v_down + i), V::Load(r.v_up + i)), inv);
+
+        T pressure = V::Neg(V::Add(gravity, V::Load(r.force + i)));
+        T du = V::Sub(V::Sub(V::Sub(V::Mul(pressure, height_grad_i),
+                                    V::Mul(force_coeff, force_grad_i)),
+                             V::Mul(u, du_di)),
+                      V::Mul(v, du_dj));
+        T dv = V::Sub(V::Sub(V::Sub(V::Mul(pressure, height_grad_j),
+                                    V::Mul(force_coeff, force_grad_j)),
+                             V::Mul(u, dv_di)),
+                      V::Mul(v, dv_dj));
+        T u_new = V::Add(V::Mul(du, dt), u);
+        T v_new = V::Add(V::Mul(dv, dt), v);
+        V::Store(r.u_out + i, u_new);
+        V::Store(r.v_out + i, v_new);
+        if (kBounds) {
+            speed = V::Max(speed, V::Max(V::Abs(u_new), V::Abs(v_new)));
+            height = V::Max(height, V::Load(r.height + i));
+        }
+    }
+};
+
+template <typename V>
+struct HeightVector {
+    typedef typename V::T T;
+    T inv, H, dt, zero;
+
+    explicit HeightVector(const StencilConstants<typename V::P::Compute>& c) :
+            inv(V::Set(c.inv_double_dwater)),
+            H(V::Set(c.H)),
+            dt(V::Set(c.dt)),
+            zero(V::Set(0.0f)) {}
+
+    void operator()(const HeightRowArgs<typename V::P::Storage>& r, int i) {
+        V::Store(r.force + i, zero);
+        T u = V::Load(r.u + i);
+        T v = V::Load(r.v + i);
+        T height = V::Load(r.height + i);
+        T vel_grad_x = V::Mul(V::Sub(V::Load(r.u + i + 1), V::Load(r.u + i - 1)), inv);
+        T u_dhdx = V::Mul(V::Mul(u, V::Sub(V::Load(r.height + i + 1), V::Load(r.height + i - 1))), inv);
+        T vel_grad_y = V::Mul(V::Sub(V::Load(r.v_down + i), V::Load(r.v_up + i)), inv);
+        T v_dhdy = V::Mul(V::Mul(v, V::Sub(V::Load(r.height_down + i), V::Load(r.height_up + i))), inv);
+        T dh = V::Sub(V::Sub(V::Mul(V::Neg(V::Add(height, H)), V::Add(vel_grad_x, vel_grad_y)),
+                             u_dhdx),
+                      v_dhdy);
+        V::Store(r.height_out + i, V::Add(V::Mul(dh, dt), height));
+    }
+};
+
+// Runs vector over [begin, end), or cell where the row is too short for a
+// whole vector.
+template <typename Vector, typename Args, typename Cell>
+void RowSimd(const Args& r, int begin, int end, int width, Vector& vector,
+             Cell cell) {
+    if (end - begin < width) {
+        for (int i = begin; i < end; i++) {
+            cell(i);
+        }
+        return;
+    }
+    int i = begin;
+    for (; i + width <= end; i += width) {
+        vector(r, i);
+    }
+    if (i < end) {
+        vector(r, end - width);
+    }
+}
+
+template <typename V>
+void VelocityRowSimd(const VelocityRowArgs<typename V::P::Storage>& r,
+                     const StencilConstants<typename V::P::Compute>& c,
+                     int begin, int end,
+                     WaveBounds<typename V::P::Compute>* bounds) {
+    typedef typename V::P P;
+    if (bounds == nullptr) {
+        VelocityVector<V, false> vector(c);
+        RowSimd(r, begin, end, V::kWidth, vector,
+                [&](int i) { VelocityCell<P>(r, c, i, nullptr); });
+    } else {
+        VelocityVector<V, true> vector(c);
+        RowSimd(r, begin, end, V::kWidth, vector,
+                [&](int i) { VelocityCell<P>(r, c, i, bounds); });
+        vector.Merge(bounds);
+    }
+}
+
+template <typename V>
+void HeightRowSimd(const HeightRowArgs<typename V::P::Storage>& r,
+                   const StencilConstants<typename V::P::Compute>& c,
+                   int begin, int end) {
+    HeightVector<V> vector(c);
+    RowSimd(r, begin, end, V::kWidth, vector,
+            [&](int i) { HeightCell<typename V::P>(r, c, i); });
+}
+
+// For the semi-Lagrangian kernels V also has I, a register of kWidth int
+// indices, with SetIndex (broadcast), Lanes (0, 1, 2, ...), AddIndex,
+// MulIndex, MinIndex, Truncate (toward zero, from T), Convert (to T) and
+// Gather (the cells of a P::Storage plane at the indices, as a T); and M, a
+// lane mask, with Less and Select (per lane, the first T where the mask is
+// set and the second where it is not) and Any (whether any lane is set).
+//
+// TraceVector is Trace for kWidth cells of row j of a row-major grid at a
+// time, in the same order, so it gives the same results.
+template <typename V>
+struct TraceVector {
+    typedef typename V::P::Storage S;
+    typedef typename V::P::Compute C;
+    typedef typename V::T T;
+    typedef typename V::I I;
+
+    struct Point {
+        I x0, y0;
+        T fx, fy;
+    };
+
+    const FusedPlanes<S>& planes;
+    int j, row, stride;
+    bool maccormack;
+    T back, forward, zero, minus_one, dimension, half, y;
+    I last, strides, lanes;
+
+    TraceVector(const FusedPlanes<S>& planes, const TraceConstants<C>& t, int j) :
+            planes(planes),
+            j(j),
+            row(j * t.stride),
+            stride(t.stride),
+            maccormack(t.maccormack),
+            back(V::Set(-t.cells_per_speed)),
+            forward(V::Set(t.cells_per_speed)),
+            zero(V::Set(0)),
+            minus_one(V::Set(-1)),
+            dimension(V::Set(C(t.dimension))),
+            half(V::Set(0.5)),
+            y(V::Set(C(j))),
+            last(V::SetIndex(t.dimension - 1)),
+            strides(V::SetIndex(t.stride)),
+            lanes(V::Lanes()) {}
+
+    void Split(T x, I* x0, T* fraction) const {
+        x = V::Min(V::Max(x, zero), dimension);
+        *x0 = V::MinIndex(V::Truncate(x), last);
+        *fraction = V::Sub(x, V::Convert(*x0));
+    }
+
+    // Move() for cells i, i + 1, ... of row j, whose columns are x, and for
+    // cells (x, y).
+    Point MoveRow(int i, T x, T step) const {
+        Point p;
+        Split(V::Add(x, V::Mul(V::Load(planes.u + row + i), step)), &p.x0, &p.fx);
+        Split(V::Add(y, V::Mul(V::Load(planes.v + row + i), step)), &p.y0, &p.fy);
+        return p;
+    }
+
+    Point MoveCells(I x, I y, T step) const {
+        I cell = V::AddIndex(V::MulIndex(y, strides), x);
+        Point p;
+        Split(V::Add(V::Convert(x), V::Mul(V::Gather(planes.u, cell), step)), &p.x0, &p.fx);
+        Split(V::Add(V::Convert(y), V::Mul(V::Gather(planes.v, cell), step)), &p.y0, &p.fy);
+        return p;
+    }
+
+    void Corners(const S* plane, const Point& p, T corner[4]) const {
+        I cell = V::AddIndex(V::MulIndex(p.y0, strides), p.x0);
+        corner[0] = V::Gather(plane, cell);
+        corner[1] = V::Gather(plane + 1, cell);
+        corner[2] = V::Gather(plane + stride, cell);
+        corner[3] = V::Gather(plane + stride + 1, cell);
+    }
+
+    // Whether every lane of p, moved from the cells of row j in columns x,
+    // starts at its own cell or at the one left of or above it. It nearly
+    // always does: a step moves the water a small part of a cell.
+    bool Near(const Point& p, T x) const {
+        // dx and dy are -1 or 0 where the largest of dx, dy, -1 - dx and
+        // -1 - dy is 0.
+        T dx = V::Sub(V::Convert(p.x0), x);
+        T dy = V::Sub(V::Convert(p.y0), y);
+        T under = V::Sub(minus_one, V::Min(dx, dy));
+        return !V::Any(V::Less(zero, V::Max(V::Max(dx, dy), under)));
+    }
+
+    // Corners() for a Near() point, picked out of the nine cells around
+    // each cell i, i + 1, ... instead of gathered. The rows and columns it
+    // does not pick can be ghost cells.
+    void NearCorners(const S* plane, const Point& p, int i, T x, T corner[4]) const {
+        typename V::M left = V::Less(V::Convert(p.x0), x);
+        typename V::M up = V::Less(V::Convert(p.y0), y);
+        T a[3], b[3];
+        for (int r = 0; r < 3; r++) {
+            const S* cells = plane + row + (r - 1) * stride + i;
+            T middle = V::Load(cells);
+            a[r] = V::Select(left, V::Load(cells - 1), middle);
+            b[r] = V::Select(left, middle, V::Load(cells + 1));
+        }
+        corner[0] = V::Select(up, a[0], a[1]);
+        corner[1] = V::Select(up, b[0], b[1]);
+        corner[2] = V::Select(up, a[1], a[2]);
+        corner[3] = V::Select(up, b[1], b[2]);
+    }
+
+    static T Lerp(T a, T b, T t) {
+        return V::Add(a, V::Mul(V::Sub(b, a), t));
+    }
+
+    static T Bilinear(const T corner[4], T fx, T fy) {
+        return Lerp(Lerp(corner[0], corner[1], fx), Lerp(corner[2], corner[3], fx), fy);
+    }
+
+    void Advect(const S* const* plane, int n, int i, T* out) const {
+        T x = V::Convert(V::AddIndex(V::SetIndex(i), lanes));
+        Point p = MoveRow(i, x, back);
+        bool near = Near(p, x);
+        T corner[2][4];
+        for (int k = 0; k < n; k++) {
+            if (near) {
+                NearCorners(plane[k], p, i, x, corner[k]);
+            } else {
+                Corners(plane[k], p, corner[k]);
+            }
+            out[k] = Bilinear(corner[k], p.fx, p.fy);
+        }
+        if (!maccormack) {
+            return;
+        }
+        Point q = MoveRow(i, x, forward);
+        T carried[2][4];
+        for (int c = 0; c < 4; c++) {
+            Point r = MoveCells(V::AddIndex(q.x0, V::SetIndex(c & 1)),
+                                V::AddIndex(q.y0, V::SetIndex(c >> 1)), back);
+            for (int k = 0; k < n; k++) {
+                T moved[4];
+                Corners(plane[k], r, moved);
+                carried[k][c] = Bilinear(moved, r.fx, r.fy);
+            }
+        }
+        for (int k = 0; k < n; k++) {
+            T round_trip = Bilinear(carried[k], q.fx, q.fy);
+            T error = V::Sub(V::Load(plane[k] + row + i), round_trip);
+            T lo = V::Min(V::Min(corner[k][0], corner[k][1]), V::Min(corner[k][2], corner[k][3]));
+            T hi = V::Max(V::Max(corner[k][0], corner[k][1]), V::Max(corner[k][2], corner[k][3]));
+            out[k] = V::Min(V::Max(V::Add(out[k], V::Mul(half, error)), lo), hi);
+        }
+    }
+};
+
+template <typename V, bool kBounds>
+struct AdvectVelocityVector {
+    typedef typename V::T T;
+    TraceVector<V> trace;
+    T inv, gravity, force_coeff, dt;
+    T speed, height;
+
+    AdvectVelocityVector(const FusedPlanes<typename V::P::Storage>& planes,
+                         const StencilConstants<typename V::P::Compute>& c,
+                         const TraceConstants<typename V::P::Compute>& t, int j) :
+            trace(planes, t, j),
+            inv(V::Set(c.inv_double_dwater)),
+            gravity(V::Set(c.gravity)),
+            force_coeff(V::Set(1.7)),
+            dt(V::Set(c.dt)),
+            speed(V::Set(0)),
+            height(V::Set(0)) {}
+
+    void Merge(WaveBounds<typename V::P::Compute>* bounds) const {
+        bounds->speed = MaxOf(bounds->speed, V::MaxLane(speed));
+        bounds->height = MaxOf(bounds->height, V::MaxLane(height));
+    }
+
+    void operator()(const FusedPlanes<typename V::P::Storage>& p, int i) {
+        const typename V::P::Storage* const velocity[2] = { p.u, p.v };
+        T carried[2];
+        trace.Advect(velocity, 2, i, carried);
+        int cell = trace.row + i, stride = trace.stride;
+        T height_grad_i = V::Mul(V::Sub(V::Load(p.height + cell + 1), V::Load(p.height + cell - 1)), inv);
+        T height_grad_j = V::Mul(V::Sub(V::Load(p.height + cell + stride),
+                                        V::Load(p.height + cell - stride)), inv);
+        T force_grad_i  = V::Mul(V::Sub(V::Load(p.force + cell + 1), V::Load(p.force + cell - 1)), inv);
+        T force_grad_j  = V::Mul(V::Sub(V::Load(p.force + cell + stride),
+                                        V::Load(p.force + cell - stride)), inv);
+
+        T pressure = V::Neg(V::Add(gravity, V::Load(p.force + cell)));
+        T u_new = V::Add(V::Mul(V::Sub(V::Mul(pressure, height_grad_i),
+                                       V::Mul(force_coeff, force_grad_i)), dt),
+                         carried[0]);
+        T v_new = V::Add(V::Mul(V::Sub(V::Mul(pressure, height_grad_j),
+                                       V::Mul(force_coeff, force_grad_j)), dt),
+                         carried[1]);
+        V::Store(p.u_out + cell, u_new);
+        V::Store(p.v_out + cell, v_new);
+        if (kBounds) {
+            speed = V::Max(speed, V::Max(V::Abs(u_new), V::Abs(v_new)));
+            height = V::Max(height, V::Load(p.height + cell));
+        }
+    }
+};
+
+template <typename V>
+struct AdvectHeightVector {
+    typedef typename V::T T;
+    TraceVector<V> trace;
+    T inv, H, dt, zero;
+
+    AdvectHeightVector(const FusedPlanes<typename V::P::Storage>& planes,
+                       const StencilConstants<typename V::P::Compute>& c,
+                       const TraceConstants<typename V::P::Compute>& t, int j) :
+            trace(planes, t, j),
+            inv(V::Set(c.inv_double_dwater)),
+            H(V::Set(c.H)),
+            dt(V::Set(c.dt)),
+            zero(V::Set(0.0f)) {}
+
+    void operator()(const FusedPlanes<typename V::P::Storage>& p, int i) {
+        int cell = trace.row + i, stride = trace.stride;
+        V::Store(p.force + cell, zero);
+        T carried;
+        trace.Advect(&p.height, 1, i, &carried);
+        T vel_grad_x = V::Mul(V::Sub(V::Load(p.u_out + cell + 1), V::Load(p.u_out + cell - 1)), inv);
+        T vel_grad_y = V::Mul(V::Sub(V::Load(p.v_out + cell + stride),
+                                     V::Load(p.v_out + cell - stride)), inv);
+        T dh = V::Mul(V::Neg(V::Add(carried, H)), V::Add(vel_grad_x, vel_grad_y));
+        V::Store(p.height_out + cell, V::Add(V::Mul(dh, dt), carried));
+    }
+};
+
+template <typename V>
+void AdvectVelocityRowSimd(const FusedPlanes<typename V::P::Storage>& p,
+                           const StencilConstants<typename V::P::Compute>& c,
+                           const TraceConstants<typename V::P::Compute>& t,
+                           int j, int begin, int end,
+                           WaveBounds<typename V::P::Compute>* bounds) {
+    typedef typename V::P P;
+    RowLayout layout = { t.stride };
+    Trace<P, RowLayout> trace(p, layout, t);
+    if (bounds == nullptr) {
+        AdvectVelocityVector<V, false> vector(p, c, t, j);
+        RowSimd(p, begin, end, V::kWidth, vector,
+                [&](int i) { AdvectVelocityCell<P>(trace, c, i, j, nullptr); });
+    } else {
+        AdvectVelocityVector<V, true> vector(p, c, t, j);
+        RowSimd(p, begin, end, V::kWidth, vector,
+                [&](int i) { AdvectVelocityCell<P>(trace, c, i, j, bounds); });
+        vector.Merge(bounds);
+    }
+}
+
+template <typename V>
+void AdvectHeightRowSimd(const FusedPlanes<typename V::P::Storage>& p,
+                         const StencilConstants<typename V::P::Compute>& c,
+                         const TraceConstants<typename V::P::Compute>& t,
+                         int j, int begin, int end) {
+    typedef typename V::P P;
+    RowLayout layout = { t.stride };
+    Trace<P, RowLayout> trace(p, layout, t);
+    AdvectHeightVector<V> vector(p, c, t, j);
+    RowSimd(p, begin, end, V::kWidth, vector,
+            [&](int i) { AdvectHeightCell<P>(trace, c, i, j); });
+}
+
+// The row functions of one kernel table, for FusedRowsFixed().
+template <typename V>
+struct SimdRows {
+    typedef typename V::P P;
+    static void Velocity(const VelocityRowArgs<typename P::Storage>& r,
+                         const StencilConstants<typename P::Compute>& c,
+                         int begin, int end, WaveBounds<typename P::Compute>* bounds) {
+        VelocityRowSimd<V>(r, c, begin, end, bounds);
+    }
+    static void Height(const HeightRowArgs<typename P::Storage>& r,
+                       const StencilConstants<typename P::Compute>& c,
+                       int begin, int end) {
+        HeightRowSimd<V>(r, c, begin, end);
+    }
+};
+
+// Row j of a row-major grid with rows kStride elements apart.
+template <int kStride, typename S>
+inline VelocityRowArgs<S> FixedVelocityRow(const FusedPlanes<S>& p, int j) {
+    int row = j * kStride;
+    VelocityRowArgs<S> r;
+    r.height      = p.height + row;
+    r.height_up   = r.height - kStride;
+    r.height_down = r.height + kStride;
+    r.force       = p.force + row;
+    r.force_up    = r.force - kStride;
+    r.force_down  = r.force + kStride;
+    r.u           = p.u + row;
+    r.u_up        = r.u - kStride;
+    r.u_down      = r.u + kStride;
+    r.v           = p.v + row;
+    r.v_up        = r.v - kStride;
+    r.v_down      = r.v + kStride;
+    r.u_out       = p.u_out + row;
+    r.v_out       = p.v_out + row;
+    return r;
+}
+
+template <int kStride, typename S>
+inline HeightRowArgs<S> FixedHeightRow(const FusedPlanes<S>& p, int j) {
+    int row = j * kStride;
+    HeightRowArgs<S> r;
+    r.height      = p.height + row;
+    r.height_up   = r.height - kStride;
+    r.height_down = r.height + kStride;
+    r.u           = p.u_out + row;
+    r.v           = p.v_out + row;
+    r.v_up        = r.v - kStride;
+    r.v_down      = r.v + kStride;
+    r.height_out  = p.height_out + row;
+    r.force       = p.force + row;
+    return r;
+}
+
+// The FixedKernels sweep for a grid kDimensionPlus cells wide with one ghost
+// cell each side, in the same order as the solver's FusedBlock(): velocity
+// row j runs one row ahead of height row j - 1, and the velocities of rows
+// j0 and j1 - 1 are already done.
+template <typename Rows, int kDimensionPlus>
+void FusedRowsFixed(const FusedPlanes<typename Rows::P::Storage>& p,
+                    const StencilConstants<typename Rows::P::Compute>& c,
+                    int j0, int j1, WaveBounds<typename Rows::P::Compute>* bounds) {
+    typedef typename Rows::P::Storage S;
+    const int kStride = RowStride(kDimensionPlus, 1, kPlaneAlignment / sizeof(S));
+    const int kDimension = kDimensionPlus - 1;
+    for (int j = j0 + 1; j < j1 - 1; j++) {
+        Rows::Velocity(FixedVelocityRow<kStride>(p, j), c, 0, kDimensionPlus, bounds);
+        if (j - 1 >= 1) {
+            Rows::Height(FixedHeightRow<kStride>(p, j - 1), c, 1, kDimension);
+        }
+    }
+    for (int j = j1 - 2 > j0 ? j1 - 2 : j0; j < j1; j++) {
+        if (j >= 1 && j < kDimension) {
+            Rows::Height(FixedHeightRow<kStride>(p, j), c, 1, kDimension);
+        }
+    }
+}
+
+// FixedKernels for every dimension in List, ending with dimension_plus 0.
+template <typename Rows, typename List>
+struct FixedTable;
+
+template <typename Rows, int... kDimensions>
+struct FixedTable<Rows, DimensionList<kDimensions...> > {
+    static const FixedKernels<typename Rows::P> entries[sizeof...(kDimensions) + 1];
+};
+
+template <typename Rows, int... kDimensions>
+const FixedKernels<typename Rows::P>
+FixedTable<Rows, DimensionList<kDimensions...> >::entries[sizeof...(kDimensions) + 1] = {
+    { kDimensions + 1,
+      RowStride(kDimensions + 1, 1, kPlaneAlignment / sizeof(typename Rows::P::Storage)),
+      FusedRowsFixed<Rows, kDimensions + 1> }...,
+    { 0, 0, nullptr }
+};
+
+}  // namespace
+
+#endif
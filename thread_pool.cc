@@ -0,0 +1,96 @@
+#include "thread_pool.h"
+
+namespace {
+
+// Spins before blocking. A solver step at interactive sizes is shorter than
+// a condition variable wake-up, so workers poll for a while first.
+const int kSpinCount = 2000;
+
+}  // namespace
+
+ThreadPool::ThreadPool(int threads) :
+        size(threads < 1 ? 1 : threads),
+        task(nullptr),
+        generation(0),
+        running(0),
+        stopping(false),
+        barrier_count(0),
+        barrier_generation(0) {
+    for (int w = 1; w < size; w++) {
+        this->threads.push_back(std::thread(&ThreadPool::WorkerLoop, this, w));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        generation++;
+    }
+    wake.notify_all();
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+}
+
+void ThreadPool::Run(const std::function<void(int)>& task) {
+    if (size == 1) {
+        task(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = &task;
+        running = size - 1;
+        generation++;
+    }
+    wake.notify_all();
+    task(0);
+    for (int spin = 0; running.load() != 0; spin++) {
+        if (spin < kSpinCount) {
+            std::this_thread::yield();
+        } else {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] { return running.load() == 0; });
+        }
+    }
+}
+
+void ThreadPool::WorkerLoop(int worker) {
+    unsigned seen = 0;
+    while (true) {
+        for (int spin = 0; generation.load() == seen; spin++) {
+            if (spin < kSpinCount) {
+                std::this_thread::yield();
+            } else {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen] { return generation.load() != seen; });
+            }
+        }
+        const std::function<void(int)>* current;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) return;
+            seen = generation.load();
+            current = task;
+        }
+        (*current)(worker);
+        if (--running == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::Barrier() {
+    if (size == 1) return;
+    unsigned phase = barrier_generation.load();
+    if (++barrier_count == size) {
+        barrier_count = 0;
+        barrier_generation++;
+        return;
+    }
+    while (barrier_generation.load() == phase) {
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// A fixed set of worker threads that stay alive for the life of the pool, so
+// stepping the solver never creates threads. Run() hands the same task to
+// every worker and Barrier() lets a task wait for the others between phases.
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+    private:
+        std::vector<std::thread> threads;
+        int size;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        const std::function<void(int)>* task;
+        std::atomic<unsigned> generation;
+        std::atomic<int> running;
+        bool stopping;
+
+        std::atomic<int> barrier_count;
+        std::atomic<unsigned> barrier_generation;
+
+        void WorkerLoop(int worker);
+
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+    public:
+        // Starts threads - 1 workers. The thread calling Run() is worker 0.
+        explicit ThreadPool(int threads);
+        ~ThreadPool();
+
+        int Size() const { return size; }
+
+        // Calls task(worker) once on each worker, 0 to Size() - 1, and
+        // returns when every call has returned.
+        void Run(const std::function<void(int)>& task);
+        // Waits until every worker in the current Run() has reached it.
+        void Barrier();
+};
+
+#endif
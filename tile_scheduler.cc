@@ -0,0 +1,77 @@
+#include "tile_scheduler.h"
+
+namespace {
+
+uint64_t Pack(uint32_t front, uint32_t back) {
+    return (uint64_t)front << 32 | back;
+}
+
+uint32_t Front(uint64_t range) { return (uint32_t)(range >> 32); }
+uint32_t Back(uint64_t range) { return (uint32_t)range; }
+
+}  // namespace
+
+TileScheduler::TileScheduler(int workers, int phases) :
+        workers(workers < 1 ? 1 : workers),
+        phases(phases),
+        deques(this->workers * phases),
+        worker_state(this->workers) {
+    for (int p = 0; p < phases; p++) {
+        Reset(p, 0);
+    }
+}
+
+void TileScheduler::Reset(int phase, int tiles) {
+    for (int w = 0; w < workers; w++) {
+        uint32_t front = (uint32_t)((long)tiles * w / workers);
+        uint32_t back = (uint32_t)((long)tiles * (w + 1) / workers);
+        Queue(phase, w).range.store(Pack(front, back));
+    }
+}
+
+bool TileScheduler::Next(int phase, int worker, int* tile) {
+    std::atomic<uint64_t>& own = Queue(phase, worker).range;
+    uint64_t range = own.load();
+    while (Front(range) < Back(range)) {
+        if (own.compare_exchange_weak(range, Pack(Front(range) + 1, Back(range)))) {
+            *tile = Front(range);
+            worker_state[worker].stats.tiles++;
+            return true;
+        }
+    }
+    for (int k = 1; k < workers; k++) {
+        if (Steal(phase, worker, (worker + k) % workers, tile)) {
+            worker_state[worker].stats.tiles++;
+            worker_state[worker].stats.steals++;
+            return true;
+        }
+    }
+    worker_state[worker].drained = Clock::now();
+    return false;
+}
+
+bool TileScheduler::Steal(int phase, int thief, int victim, int* tile) {
+    std::atomic<uint64_t>& from = Queue(phase, victim).range;
+    uint64_t range = from.load();
+    while (Front(range) < Back(range)) {
+        uint32_t count = Back(range) - Front(range);
+        uint32_t split = Back(range) - (count + 1) / 2;
+        if (from.compare_exchange_weak(range, Pack(Front(range), split))) {
+            *tile = split;
+            Queue(phase, thief).range.store(Pack(split + 1, Back(range)));
+            return true;
+        }
+    }
+    return false;
+}
+
+void TileScheduler::Resume(int worker) {
+    Worker& w = worker_state[worker];
+    w.stats.idle_seconds += std::chrono::duration<double>(Clock::now() - w.drained).count();
+}
+
+void TileScheduler::ResetStats() {
+    for (int w = 0; w < workers; w++) {
+        worker_state[w].stats = WorkerStats();
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+// Hands out tile indices to the workers of a ThreadPool, one phase at a time,
+// with work stealing. Each worker starts a phase with a contiguous run of
+// tiles in its own deque and takes them from the front. A worker whose deque
+// is empty steals the back half of another worker's deque, so tiles that
+// cost more than others (rain impacts, a core shared with another job) do
+// not leave the rest of the pool idle at the end of the phase.
+//
+// A deque is a range [front, back) of tile indices packed into one atomic
+// word, so the owner and thieves both claim tiles with a compare-and-swap.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Counters for one worker, summed over every phase since the last
+// ResetStats().
+struct WorkerStats {
+    long tiles = 0;            // tiles this worker ran
+    long steals = 0;           // successful steals from another worker
+    double idle_seconds = 0;   // time between running out of tiles and the
+                               // end of the phase
+};
+
+class TileScheduler {
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        // One cache line per worker and phase so that claiming tiles does
+        // not contend with the neighbouring deques.
+        struct Deque {
+            std::atomic<uint64_t> range;
+            char padding[64 - sizeof(std::atomic<uint64_t>)];
+        };
+        struct Worker {
+            WorkerStats stats;
+            Clock::time_point drained;
+            char padding[64];
+        };
+
+        int workers;
+        int phases;
+        std::vector<Deque> deques;    // phases * workers
+        std::vector<Worker> worker_state;
+
+        Deque& Queue(int phase, int worker) { return deques[phase * workers + worker]; }
+        // Moves the back half of victim's deque into thief's, which must be
+        // empty, and returns one of the stolen tiles in tile.
+        bool Steal(int phase, int thief, int victim, int* tile);
+
+        TileScheduler(const TileScheduler&);
+        TileScheduler& operator=(const TileScheduler&);
+    public:
+        TileScheduler(int workers, int phases);
+
+        // Splits tiles [0, tiles) of phase into one contiguous run per
+        // worker. Call it before the workers start, not during a phase.
+        void Reset(int phase, int tiles);
+        // The next tile of phase for worker, from its own deque or stolen.
+        // Returns false once every deque of the phase is empty.
+        bool Next(int phase, int worker, int* tile);
+        // Call after the barrier that ends a phase. Counts the time since
+        // Next() last returned false as idle.
+        void Resume(int worker);
+
+        int Workers() const { return workers; }
+        const WorkerStats& Stats(int worker) const { return worker_state[worker].stats; }
+        void ResetStats();
+};
+
+#endif
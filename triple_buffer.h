@@ -0,0 +1,56 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+// Hands values from one writer thread to one reader thread without locks
+// and without either side ever waiting for the other. The writer fills
+// Back() and publishes it; the reader takes the newest published value with
+// Acquire() and reads Front() until its next Acquire(). Values the reader
+// never took are overwritten.
+
+#include <atomic>
+
+template <typename T>
+class TripleBuffer {
+    private:
+        static const int kIndex = 3;
+        static const int kFresh = 4;  // set while the middle slot is unread
+
+        T slots[3];
+        int back;                 // the writer's slot
+        std::atomic<int> middle;  // the slot in between, plus kFresh
+        int front;                // the reader's slot
+
+        TripleBuffer(const TripleBuffer&);
+        TripleBuffer& operator=(const TripleBuffer&);
+    public:
+        // Every slot starts as a copy of initial, and Front() reads it
+        // before the first Acquire().
+        explicit TripleBuffer(const T& initial) :
+                back(0),
+                middle(1),
+                front(2) {
+            for (int s = 0; s < 3; s++) {
+                slots[s] = initial;
+            }
+        }
+
+        // Writer side.
+        T& Back() { return slots[back]; }
+        // Makes Back() the newest value and gives the writer another slot.
+        void Publish() {
+            back = middle.exchange(back | kFresh, std::memory_order_acq_rel) & kIndex;
+        }
+
+        // Reader side. Returns false, keeping Front(), if nothing was
+        // published since the last Acquire().
+        bool Acquire() {
+            if ((middle.load(std::memory_order_relaxed) & kFresh) == 0) {
+                return false;
+            }
+            front = middle.exchange(front, std::memory_order_acq_rel) & kIndex;
+            return true;
+        }
+        const T& Front() const { return slots[front]; }
+};
+
+#endif